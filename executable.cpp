@@ -7,18 +7,59 @@
 // To query data, enter 2.
 // To extract data, enter 3.
 // To delete data, enter 4.
+// To benchmark the dataset reader, enter 5.
+// To benchmark single-pass against tiled detection, enter 6.
+// To find images similar to a given image, enter 7.
+// To compact shared containers, enter 8.
+// To benchmark per-experiment files against shared containers, enter 9.
+// To show, clear or remove the shared image cache, enter 10.
 
 // Data Insert:
 // Enter metadata and a link to the folder containing the raw image data.
 // 'Experiment Name' must be a unique field.
 // The raw image data will be converted into adios bp file, the location of which will be stored in the database along with the metadata.
+// Images keep their native channel count and element type (8/16-bit integer or float), stored as typed ADIOS variables and restored as the same cv::Mat type on extraction.
+// Optionally, images larger than a given tile size are stored as a grid of tiles (one ADIOS block per tile) so that regions can be read without reading the whole image.
+// OpenCV refuses to decode images over 2^30 pixels by default; ingest raises that limit to MAX_DECODE_PIXELS (2^34, e.g. 50k x 50k slide scans) unless OPENCV_IO_MAX_IMAGE_PIXELS is set.
+// Optionally, each image gets downsampled levels (pyramid/L<k>/<file>, 1/2^k of full size) and a thumbnail of at most 256px (thumbnail/<file>).
+// Optionally, images of identical size are stored together as one {N, height, width, channels} variable named group_<height>x<width>x<channels>, with the file names in its '/names' attribute.
+// Optionally, the experiment is appended to a shared container (ImageBPFiles/containers/container_<id>.bp) instead of a file of its own, every variable and attribute name carrying the prefix stored in its catalog row.
 
 // Data Query:
-// Query parameter is 'Experiment Name', thus enter the name of the experiment to query.
-// Data Query returns the metadata for the experiment.
+// Experiments can be filtered by author, name prefix, creation date range and storage size, every filter being optional.
+// Only the chosen columns are returned (metadataContent only when asked for), ordered by name, creation date, size or id and read a page at a time.
+// Pages continue from the last row of the previous one (keyset pagination). Every order, alone or under an author filter, seeks its index straight to the page;
+// a name prefix, date or size range only narrows the index walk when the results are ordered by that column, otherwise the rows it excludes are skipped one by one.
+// Output is either labelled rows or JSON lines (flag 2 followed by jsonl), which streams every page to stdout with the prompts on stderr.
 
 // Data Extract:
 // The adios bp data will be converted into raw images, and the metadata will be shown along with output location.
+// A resolution level can be chosen; levels other than 0 are read from the pyramid variables and are much smaller than the full images.
+
+// Dataset Reader:
+// ImageDataset gives C++ consumers random access to the images of one experiment without writing them out to disk.
+// Epochs are read ahead by background workers into a recycled buffer pool; the benchmark reports images/s for sequential and shuffled access.
+
+// Similarity Search:
+// Ingest stores a 64-bit perceptual hash per image (and a feature embedding when the EMBEDDING_LAYER environment variable names a layer of the network and AI metadata is generated) in the image_hashes table.
+// The hash is split into four 16-bit bands, each indexed, so a query only looks up rows sharing a band within a small Hamming radius (multi-index hashing).
+
+// Shared Containers:
+// Many small experiments packed into a few BP4 containers keep the file count down on parallel filesystems.
+// Deleting a packed experiment only removes its catalog row and records a tombstone; compaction later copies the live experiments into a new container and switches the catalog over in one transaction.
+// Ingest converts into a staging file and locks the container only to copy the experiment in and insert its row; delete and compaction give up on a lock held for more than 30 seconds.
+// Readers never take the container lock, and the replaced container is kept for an hour for readers that looked up its path before the switch.
+
+// Shared Image Cache:
+// With IMAGE_CACHE_MB set, decoded images are kept in a POSIX shared memory segment of that size that every process of the tool attaches to.
+// Extraction and ImageDataset look up whole images there, keyed by catalog row id (never reused, kept by compaction), variable and frame, before reading them from ADIOS.
+// Keys are found through a hash index and free space through a coalescing extent list; images are copied outside the lock while pinned.
+// Pins and fills record their process id, so those left by a killed process are reclaimed when the cache runs out of space and every few thousand lock acquisitions.
+// The least recently used images are evicted once the segment is full, and no image may take more than a quarter of it; hits, misses and evictions are counted in the segment.
+
+// Tiled Detection:
+// Large images are cut into overlapping 640px windows that run as batched forward passes on several threads, with boxes mapped back to the full image and merged by NMS.
+// Small objects survive this, while the single pass squashes the whole image to 640x640.
 
 // Progress:
 // Metadata associated with image variable to be stored in the /bp file 
@@ -42,6 +83,32 @@
 #include <vector>
 #include <experimental/filesystem>
 #include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 // Define the path to the builds for the following in CMakeLists.txt
 #include <adios2.h>
@@ -62,9 +129,259 @@ struct Detection
 };
 
 
+struct ImageHash {
+    std::string fileName;
+    uint64_t phash;
+    std::vector<float> embedding;   // Empty unless an embedding layer is configured and AI metadata was generated
+};
+
+struct SimilarImage {
+    std::string experimentName;
+    std::string fileName;
+    int distance;
+    float similarity;   // Cosine similarity of the embeddings, 0 when either side has none
+};
+
 struct ConversionResult {
     std::string outputPath;
     std::string metadataContent;
+    std::vector<ImageHash> hashes;
+    size_t storageBytes;   // Pixel data written, downsampled levels included
+};
+
+// One page of a catalog query. Empty strings and negative sizes do not filter.
+struct CatalogQuery {
+    std::string author;
+    std::string namePrefix;
+    std::string createdFrom;           // YYYY-MM-DD, inclusive
+    std::string createdTo;             // YYYY-MM-DD, inclusive
+    long long minStorageBytes = -1;
+    long long maxStorageBytes = -1;
+    std::vector<std::string> columns;  // Projection, empty for the default columns
+    std::string orderBy = "name";      // name, created, size or id
+    bool descending = false;
+    size_t pageSize = 20;
+
+    // Sort value and id of the last row of the previous page
+    bool hasCursor = false;
+    std::string cursorValue;
+    long long cursorId = 0;
+};
+
+struct CatalogPage {
+    std::vector<std::string> columns;
+    std::vector<std::vector<std::string>> rows;
+    bool hasMore = false;
+    std::string nextValue;   // Cursor for the following page, set when hasMore
+    long long nextId = 0;
+};
+
+struct ConversionOptions {
+    int tileSize = 0;            // Images larger than this are tiled, 0 stores every image as a single block
+    bool groupByShape = false;   // Store identically sized images as one 4-D variable
+    bool pyramid = false;        // Store downsampled levels and a thumbnail next to each image
+    std::string containerPath;   // BP4 file to write to instead of the experiment's own, the staging file of a container ingest
+    std::string variablePrefix;  // Prepended to every variable and attribute name inside a shared container
+    int metadataChoice = 0;      // Used when the raw directory has no metadata.txt: 1 empty, 2 AI generated, 3 custom
+    std::string customMetadata;  // Metadata content for choice 3
+};
+
+// A {N, height, width, channels} variable being filled during ingest
+struct ImageGroup {
+    size_t height;
+    size_t width;
+    size_t channels;
+    int depth;
+    std::vector<std::string> names;   // File name per slot, empty if the slot was not written
+};
+
+struct CacheStatistics {
+    uint64_t capacity;
+    uint64_t used;
+    uint64_t entries;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t insertions;
+};
+
+// An image handed out by ImageDataset.
+// The cv::Mat is a view over a pooled buffer that goes back to the pool once every copy of the DatasetImage is gone, so keep it alive while the Mat is in use.
+// An epoch hands out images that failed to read with an empty Mat and an empty buffer.
+struct DatasetImage {
+    std::string name;
+    cv::Mat image;
+    std::shared_ptr<std::vector<uint8_t>> buffer;
+};
+
+//*****************************************************************************************************************************************************************
+
+//Classes
+
+// Recycles image buffers between reads so that iterating a dataset does not allocate once it is warmed up
+class BufferPool {
+public:
+    std::shared_ptr<std::vector<uint8_t>> acquire(size_t bytes);
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::vector<std::vector<uint8_t>*> available;
+        ~State();
+    };
+
+    // Handed-out buffers hold a reference to the state, so it outlives the pool if they do
+    std::shared_ptr<State> state = std::make_shared<State>();
+};
+
+// Decoded images shared between processes through a POSIX shared memory segment, least recently used evicted first.
+// Enabled by setting IMAGE_CACHE_MB to the size cap; the process that creates the segment fixes its size for every process attaching later.
+// The lock only guards the index, images are copied in and out with their extent pinned so that processes do not wait on each other's copies.
+class SharedImageCache {
+public:
+    // The cache of this process, attached on first use
+    static SharedImageCache& instance();
+
+    // Unlinks the segment, false if there was none; processes still attached keep it until they exit
+    static bool remove();
+
+    ~SharedImageCache();
+
+    bool enabled() const;
+
+    // Copies a cached image into data, false on a miss
+    bool get(const std::string& key, void* data, size_t bytes);
+
+    // Stores a copy of an image, evicting the least recently used ones until it fits; images over a quarter of the capacity are not stored
+    void put(const std::string& key, const void* data, size_t bytes);
+
+    CacheStatistics statistics();
+    void clear();
+
+private:
+    struct Slot;
+    struct Extent;
+    struct Header;
+
+    SharedImageCache();
+    static uint64_t hashKey(const std::string& key);
+    bool lock();
+    void unlock();
+    void reset();
+    int32_t find(const std::string& key, uint64_t hash);
+    void link(int32_t index);
+    void unlink(int32_t index);
+    void release(int32_t index);
+    void evict(int32_t index);
+    void reclaim();
+    int32_t allocate(size_t bytes);
+
+    Header* header = nullptr;
+    uint8_t* data = nullptr;
+    size_t mappedBytes = 0;
+};
+
+// Random-access reader over the images of one experiment's images.bp
+class ImageDataset {
+public:
+    class Epoch;
+
+    // level 0 reads full resolution images, level k the 1/2^k pyramid level and -1 the thumbnails.
+    // prefix selects one experiment inside a shared container.
+    // cacheIdentity (experimentCacheIdentity of the catalog row) keys whole images in the shared image cache, empty reads bypass it.
+    ImageDataset(const std::string& bpPath, size_t prefetchDepth = 8, size_t workerCount = 2, int level = 0, const std::string& prefix = "", const std::string& cacheIdentity = "");
+    ~ImageDataset();
+
+    size_t size() const;
+    const std::string& name(size_t i) const;
+    cv::Size imageSize(size_t i) const;
+    DatasetImage operator[](size_t i);
+
+    // Reads only part of an image; for tiled images only the tiles intersecting the region are fetched
+    DatasetImage region(size_t i, const cv::Rect& region);
+
+    // Starts a pass over every image, in file order or shuffled. The epoch must not outlive the dataset.
+    std::unique_ptr<Epoch> epoch(bool shuffle, unsigned seed = std::random_device()());
+
+private:
+    struct Entry {
+        std::string name;
+        std::string variable;
+        long slot;   // Position inside a group variable, -1 for images stored on their own
+        size_t height;
+        size_t width;
+        size_t channels;
+        int depth;
+    };
+
+    DatasetImage read(adios2::IO& io, adios2::Engine& engine, size_t i, const cv::Rect& region);
+
+    std::string bpPath;
+    std::string cacheIdentity;
+    size_t prefetchDepth;
+    size_t workerCount;
+    std::vector<Entry> entries;
+    BufferPool pool;
+
+    // Engine used by operator[]; epoch workers open their own so that reads can proceed in parallel
+    adios2::ADIOS adios;
+    adios2::IO bpIO;
+    adios2::Engine bpReader;
+    std::mutex readerMutex;
+};
+
+// Generates AI metadata on a background thread from frames decoded by ingest.
+// Frames are shared with the ADIOS writer by reference, so each image is decoded once and detection overlaps the BP write.
+class MetadataGenerator {
+public:
+    MetadataGenerator();
+    ~MetadataGenerator();
+
+    // Queues a frame for detection, blocking while METADATA_QUEUE_DEPTH frames are already waiting
+    void submit(const std::string& fileName, const cv::Mat& frame);
+
+    // Waits for every queued frame and returns the classification per file name
+    std::map<std::string, std::string> finish();
+
+    // Feature embedding per file name, complete once finish() has returned
+    const std::map<std::string, std::vector<float>>& embeddings() const;
+
+private:
+    void worker();
+
+    std::vector<std::string> class_list;
+    std::vector<cv::dnn::Net> nets;
+    bool computeEmbeddings = false;
+    std::deque<std::pair<std::string, cv::Mat>> pending;
+    std::map<std::string, std::string> classifications;
+    std::map<std::string, std::vector<float>> frameEmbeddings;
+    bool finished = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread thread;
+};
+
+// One pass over an ImageDataset. Workers keep up to prefetchDepth images ready ahead of the consumer.
+class ImageDataset::Epoch {
+public:
+    Epoch(ImageDataset& dataset, std::vector<size_t> order);
+    ~Epoch();
+
+    // Returns false once every image of the epoch has been handed out
+    bool next(DatasetImage& out);
+
+private:
+    void worker();
+
+    ImageDataset& dataset;
+    std::vector<size_t> order;
+    size_t nextToFetch = 0;
+    size_t nextToConsume = 0;
+    bool stopping = false;
+    std::map<size_t, DatasetImage> ready;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::thread> workers;
 };
 
 //*****************************************************************************************************************************************************************
@@ -77,33 +394,188 @@ std::vector<std::string> load_class_list();
 // Load NN
 void load_net(cv::dnn::Net &net, bool is_cuda);
 
-// Perform Detection
-void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, const std::vector<std::string> &className);
+// Perform Detection; with embedding set, EMBEDDING_LAYER is read from the same forward pass
+void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, const std::vector<std::string> &className, std::vector<float> *embedding = nullptr);
 
-// Generate Metadata
-const std::string aiGen(const std::string& imagePath);
+// Collect candidate boxes from one image's network output, shifted by offset
+void collectDetections(const float *data, float x_factor, float y_factor, const cv::Point &offset, const std::vector<std::string> &className, std::vector<int> &class_ids, std::vector<float> &confidences, std::vector<cv::Rect> &boxes);
+
+// Perform Detection over overlapping windows, one network per thread
+void detectTiled(cv::Mat &image, std::vector<cv::dnn::Net> &nets, std::vector<Detection> &output, const std::vector<std::string> &className);
+
+// Generate Metadata for a decoded image; embedding, when given, is filled from the detection pass of frames detected in one pass
+const std::string aiGen(const cv::Mat& image, std::vector<cv::dnn::Net>& nets, const std::vector<std::string>& class_list, std::vector<float>* embedding = nullptr);
+
+// Convert an image of any depth and channel count to the 8-bit BGR the network expects, without copying when it already is
+cv::Mat toInferenceImage(const cv::Mat& image);
+
+// 64-bit DCT perceptual hash, near-duplicates differ in few bits
+uint64_t perceptualHash(const cv::Mat& image);
+
+// Global average pooled, L2 normalised activations of EMBEDDING_LAYER
+std::vector<float> computeEmbedding(const cv::Mat& image, cv::dnn::Net& net);
+
+// Pools {1, channels, height, width} activations into an embedding
+std::vector<float> poolEmbedding(const cv::Mat& features);
+
+// Whether EMBEDDING_LAYER is set and names a layer of the network, reports a name the export does not have
+bool hasEmbeddingLayer(const cv::dnn::Net& net);
+
+// Pixels OpenCV may decode during ingest, raised from its default of 2^30 so that whole slide scans can be tiled
+const uint64_t MAX_DECODE_PIXELS = uint64_t(1) << 34;
+
+// Write an image as a grid of tiles, one ADIOS block per tile
+void writeTiledImage(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& fileName, const cv::Mat& image, int tileSize);
+
+// Write a block of image data as an ADIOS variable of the element type matching an OpenCV depth, defining the variable on first use
+bool putImageData(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& variableName, int depth, const adios2::Dims& shape, const adios2::Dims& start, const adios2::Dims& count, const void* data);
+
+// Read a selection of an image variable written by putImageData
+bool getImageData(adios2::IO& bpIO, adios2::Engine& bpReader, const std::string& variableName, int depth, const adios2::Dims& start, const adios2::Dims& count, void* data);
+
+// Key of a whole image or group frame of an experiment in the shared image cache
+std::string imageCacheKey(const std::string& cacheIdentity, const std::string& variableName, const adios2::Dims& start);
+
+// getImageData for a whole image or group frame, served from the shared image cache when it holds it; an empty identity bypasses the cache
+bool readImageCached(adios2::IO& bpIO, adios2::Engine& bpReader, const std::string& cacheIdentity, const std::string& variableName, int depth, const adios2::Dims& start, const adios2::Dims& count, void* data);
+
+// Identity of a catalog experiment in shared image cache keys, unique per ingest
+std::string experimentCacheIdentity(long experimentId);
+
+// Look up the OpenCV depth and shape of an image variable, false if its type holds no image
+bool inquireImageVariable(adios2::IO& bpIO, const std::string& variableName, int& depth, adios2::Dims& shape);
+
+// Read an image's dimensions, channel count and depth from its file header without decoding it (JPEG and PNG)
+bool probeImageShape(const std::string& imagePath, int& height, int& width, int& channels, int& depth);
+
+// Name of the group variable holding images of the given shape and depth
+std::string groupVariableName(size_t height, size_t width, size_t channels, int depth);
+
+// Downsample an image by halves until its longest side fits THUMBNAIL_SIZE
+std::vector<cv::Mat> buildPyramid(const cv::Mat& image);
+
+// Write the levels produced by buildPyramid, the smallest one being the thumbnail
+void writePyramid(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& prefix, const std::string& fileName, const cv::Mat& image, const std::vector<cv::Mat>& levels, int tileSize);
+
+// Pick the variable holding an image at a resolution level, falling back to the thumbnail when the image has no such level
+std::string levelVariableName(const std::map<std::string, adios2::Params>& variables, const std::string& fileName, int level);
+
+// Whether a variable holds a pyramid level or thumbnail rather than a full resolution image
+bool isDerivedVariable(const std::string& variableName);
 
 // Convert Images to BP Format
-ConversionResult convert_images(const std::string& experimentName, const std::string& rawPath);
+ConversionResult convert_images(const std::string& experimentName, const std::string& rawPath, const ConversionOptions& options = ConversionOptions());
 
 // Inserts Data into SQLite Database
-void insertDataToDatabase(const std::string& authorName, const std::string& experimentName, const std::string& adiosOutputPath, const std::string& metadataContent);
+void insertDataToDatabase(const std::string& authorName, const std::string& experimentName, const std::string& adiosOutputPath, const std::string& metadataContent, const std::string& variablePrefix, size_t storageBytes);
+
+// Creates the experiment and container tables, adding columns missing from older catalogs
+bool createExperimentTable(sqlite3* db);
+
+// Prepares, binds and runs a statement that returns no rows
+bool runStatement(sqlite3* db, const std::string& query, const std::vector<std::string>& values);
 
 // Checks if experiment is in Database
 bool checkdb(const std::string& experimentName);
 
+// Creates the image hash table and its band indexes if they do not exist
+bool createHashTable(sqlite3* db);
+
+// Inserts the perceptual hashes and embeddings of an experiment's images
+void insertImageHashes(const std::string& experimentName, const std::vector<ImageHash>& hashes);
+
+// Collects every 16-bit value within the given Hamming radius of a hash band
+void bandVariants(int value, int radius, int firstBit, std::vector<int>& variants);
+
+// Finds the images most similar to a given image across all experiments
+void findSimilarImages();
+
+// Asks how to fill in the metadata of a directory without metadata.txt, returning the choice (1 empty, 2 AI, 3 custom)
+int chooseMetadata(std::string& customMetadata);
+
 // Retrieves Data from user, converts images and inserts into Sqlite
 void insertDataAndGetPath();
 
-// Queries all experiments in database
-bool queryAllData();
+// Prompts for filters, projection and order, then pages through the matching experiments.
+// With jsonLines the prompts go to stderr, so stdout carries nothing but the JSON lines.
+bool queryExperiments(bool jsonLines);
+
+// Runs one page of a catalog query
+bool queryCatalog(sqlite3* db, const CatalogQuery& query, CatalogPage& page);
+
+// Prints a page as labelled rows or as JSON lines
+void printCatalogPage(const CatalogPage& page, bool jsonLines);
+
+// Escapes a string for use inside a JSON string literal
+std::string jsonEscape(const std::string& value);
+
+// Whether a string is exactly YYYY-MM-DD with a month of 1-12 and a day of 1-31
+bool isCalendarDate(const std::string& date);
+
+// Lists the names of the most recently created experiments before extract and delete prompt for one
+void listLatestExperiments();
 
 // Extracts images from BP Format to output folder
 void extractImages();
 
+// Extracts the images of one resolution level to output folder
+void extractLevel(adios2::IO& bpIO, adios2::Engine& bpReader, const std::map<std::string, adios2::Params>& variables, const std::string& prefix, const std::string& cacheIdentity, const std::string& outputFolder, int level);
+
 // Deletes experiment from database and bp file
 void deleteExperiment();
 
+// Looks up the BP file path and variable prefix of an experiment, false if not found
+bool getExperimentLocation(const std::string& experimentName, std::string& adiosImagePath, std::string& variablePrefix, long& experimentId);
+
+// The variables of one experiment inside a BP file, keyed by name without the prefix
+std::map<std::string, adios2::Params> experimentVariables(adios2::IO& bpIO, const std::string& prefix);
+
+const std::string CONTAINER_DIRECTORY = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/containers/";
+const int CONTAINER_CAPACITY = 256;          // Live experiments per container before a new one is started
+const int CONTAINER_RETIRE_SECONDS = 3600;   // How long a replaced container is kept for readers that looked up its path before compaction
+const int CONTAINER_LOCK_WAIT_SECONDS = 30; // How long delete and compaction wait for a container held by another process
+
+// Reserves a slot in the newest container with room, returning the container's id and the prefix for the experiment
+bool reserveContainerSlot(const std::string& experimentName, int& containerId, std::string& variablePrefix);
+
+// Copies an experiment staged in a BP file of its own into its container, returning the container's path and its lock (-1 on failure).
+// The lock is left held so that the caller can insert the catalog row before compaction sees the container.
+int appendToContainer(int containerId, const std::string& stagingPath, const std::string& variablePrefix, std::string& containerPath);
+
+// Takes the exclusive lock serialising appends and compaction of a container, -1 on failure. Closing the descriptor releases it.
+// A negative wait blocks until the lock is free, otherwise it gives up after that many seconds.
+int lockContainer(int containerId, int waitSeconds);
+
+// Takes the lock of the container at a path within CONTAINER_LOCK_WAIT_SECONDS, -1 if the path is not a container or the lock fails
+int lockContainerAt(sqlite3* db, const std::string& containerPath);
+
+// Marks the variables under a prefix as garbage for the next compaction of their container
+bool tombstoneExperiment(const std::string& containerPath, const std::string& variablePrefix);
+
+// Copies the variables and attributes under a prefix into another BP file, keeping their block layout
+void copyExperiment(adios2::IO& sourceIO, adios2::Engine& bpReader, adios2::IO& targetIO, adios2::Engine& bpWriter, const std::string& prefix);
+
+// Rewrites one container without its tombstoned experiments and switches the catalog over to the copy
+bool compactContainer(int containerId);
+
+// Compacts every container holding tombstones and removes containers retired long enough ago
+void compactContainers();
+
+// Total size and file count below a path
+void directoryUsage(const std::string& path, size_t& bytes, size_t& files);
+
+// Compares open, list and extract latency of per-experiment files and shared containers
+void benchmarkContainers();
+
+// Shows the shared image cache statistics and optionally clears or removes it
+void manageImageCache();
+
+// Measures dataset reader throughput for sequential and shuffled access
+void benchmarkReader();
+
+// Compares latency and detections of single-pass and tiled detection
+void benchmarkDetection();
+
 // Main
 int main(int argc, char** argv);
 
@@ -113,29 +585,52 @@ int main(int argc, char** argv);
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        std::cout << "Usage: Pass in a flag 1, 2, 3, 4 to make a choice.\n1.) Insert Data\n2.) Query Data\n3.) Extract Data\n4.) Delete Data\n";
+        std::cout << "Usage: Pass in a flag 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 to make a choice.\n1.) Insert Data\n2.) Query Data (2 jsonl for JSON lines)\n3.) Extract Data\n4.) Delete Data\n5.) Benchmark Reader\n6.) Benchmark Detection\n7.) Find Similar Images\n8.) Compact Containers\n9.) Benchmark Containers\n10.) Image Cache\n";
         return 1;
     }
 
     int choice = std::stoi(argv[1]);
 
-    std::cout << "\nSelected Choice: " << choice << "\n";
-    std::cout << "-----------------------------" << std::endl;
+    // OpenCV reads its decoder limits once when the library is loaded, so ingest re-executes itself with the raised limit in the environment
+    if (choice == 1 && !std::getenv("OPENCV_IO_MAX_IMAGE_PIXELS")) {
+        setenv("OPENCV_IO_MAX_IMAGE_PIXELS", std::to_string(MAX_DECODE_PIXELS).c_str(), 1);
+        execv("/proc/self/exe", argv);
+        std::cerr << "Warning: Couldn't raise the decoder pixel limit, images over 2^30 pixels will fail to load" << std::endl;
+    }
+
+    // "2 jsonl" streams the query results as JSON lines, everything else printed goes to stderr so stdout can be piped
+    const bool jsonLines = (choice == 2 && argc > 2 && std::string(argv[2]) == "jsonl");
+    std::ostream& banner = jsonLines ? std::cerr : std::cout;
+
+    banner << "\nSelected Choice: " << choice << "\n";
+    banner << "-----------------------------" << std::endl;
 
     if (choice == 1) {
         insertDataAndGetPath();
     } else if (choice == 2) {
-        queryAllData();
+        queryExperiments(jsonLines);
     } else if (choice == 3) {
         extractImages();
     } else if (choice == 4) {
         deleteExperiment();
+    } else if (choice == 5) {
+        benchmarkReader();
+    } else if (choice == 6) {
+        benchmarkDetection();
+    } else if (choice == 7) {
+        findSimilarImages();
+    } else if (choice == 8) {
+        compactContainers();
+    } else if (choice == 9) {
+        benchmarkContainers();
+    } else if (choice == 10) {
+        manageImageCache();
     } else {
-        std::cerr << "Invalid choice. Please provide a valid flag (1, 2, 3 or 4)\n";
+        std::cerr << "Invalid choice. Please provide a valid flag (1, 2, 3, 4, 5, 6, 7, 8, 9 or 10)\n";
         return 1;
     }
 
-    std::cout << "\nThank you!\nTerminating\n";
+    banner << "\nThank you!\nTerminating\n";
     return 0;
 }
 
@@ -188,6 +683,16 @@ const float SCORE_THRESHOLD = 0.2;
 const float NMS_THRESHOLD = 0.4;
 const float CONFIDENCE_THRESHOLD = 0.4;
 
+const int TILE_OVERLAP = 128;          // Pixels shared by neighbouring windows, so objects cut by one window are whole in the next
+const size_t INFERENCE_BATCH = 4;      // Windows per forward pass
+const size_t INFERENCE_THREADS = 4;    // Networks running windows in parallel
+const int TILED_MIN_SIZE = 1280;       // Images whose longest side exceeds this use tiled detection for metadata
+const size_t METADATA_QUEUE_DEPTH = 4; // Decoded frames waiting for detection during ingest
+
+// Layer whose activations serve as the image embedding, read from the EMBEDDING_LAYER environment variable, e.g. the SPPF output of yolov5s;
+// names depend on the ONNX export, unset disables embeddings
+const std::string EMBEDDING_LAYER = std::getenv("EMBEDDING_LAYER") ? std::getenv("EMBEDDING_LAYER") : "";
+
 cv::Mat format_yolov5(const cv::Mat &source) {
     int col = source.cols;
     int row = source.rows;
@@ -201,7 +706,7 @@ cv::Mat format_yolov5(const cv::Mat &source) {
 
 // Perform Detection
 
-void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, const std::vector<std::string> &className) {
+void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, const std::vector<std::string> &className, std::vector<float> *embedding) {
     cv::Mat blob;
 
     auto input_image = format_yolov5(image);
@@ -212,27 +717,55 @@ void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, c
 
     std::vector<cv::Mat> outputs;
 
-    net.forward(outputs, net.getUnconnectedOutLayersNames());
+    std::vector<std::string> outputNames = net.getUnconnectedOutLayersNames();
+    if (embedding) {
+        outputNames.push_back(EMBEDDING_LAYER);
+    }
+    net.forward(outputs, outputNames);
+
+    if (embedding) {
+        *embedding = poolEmbedding(outputs.back());
+    }
 
     float x_factor = input_image.cols / INPUT_WIDTH;
     float y_factor = input_image.rows / INPUT_HEIGHT;
     
-    float *data = (float *)outputs[0].data;
-
-    const int dimensions = 85;
-    const int rows = 25200;
-    
     std::vector<int> class_ids;
     std::vector<float> confidences;
     std::vector<cv::Rect> boxes;
 
-    for (int i = 0; i < rows; ++i) {
+    collectDetections((float *)outputs[0].data, x_factor, y_factor, cv::Point(0, 0), className, class_ids, confidences, boxes);
+
+    std::vector<int> nms_result;
+    cv::dnn::NMSBoxes(boxes, confidences, SCORE_THRESHOLD, NMS_THRESHOLD, nms_result);
+    for (int i = 0; i < nms_result.size(); i++) {
+        int idx = nms_result[i];
+        Detection result;
+        result.class_id = class_ids[idx];
+        result.confidence = confidences[idx];
+        result.box = boxes[idx];
+        output.push_back(result);
+    }
+}
+
+//*****************************************************************************************************************************************************************
+
+// Collect Detections
+
+const int OUTPUT_DIMENSIONS = 85;
+const int OUTPUT_ROWS = 25200;
+
+void collectDetections(const float *data, float x_factor, float y_factor, const cv::Point &offset, const std::vector<std::string> &className, std::vector<int> &class_ids, std::vector<float> &confidences, std::vector<cv::Rect> &boxes) {
+    // The network output is only read, so the class scores of each candidate are copied into a Mat of their own
+    cv::Mat scores(1, className.size(), CV_32FC1);
+
+    for (int i = 0; i < OUTPUT_ROWS; ++i) {
 
         float confidence = data[4];
         if (confidence >= CONFIDENCE_THRESHOLD) {
 
-            float * classes_scores = data + 5;
-            cv::Mat scores(1, className.size(), CV_32FC1, classes_scores);
+            const float * classes_scores = data + 5;
+            std::copy(classes_scores, classes_scores + className.size(), scores.ptr<float>());
             cv::Point class_id;
             double max_class_score;
             minMaxLoc(scores, 0, &max_class_score, 0, &class_id);
@@ -246,8 +779,8 @@ void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, c
                 float y = data[1];
                 float w = data[2];
                 float h = data[3];
-                int left = int((x - 0.5 * w) * x_factor);
-                int top = int((y - 0.5 * h) * y_factor);
+                int left = int((x - 0.5 * w) * x_factor) + offset.x;
+                int top = int((y - 0.5 * h) * y_factor) + offset.y;
                 int width = int(w * x_factor);
                 int height = int(h * y_factor);
                 boxes.push_back(cv::Rect(left, top, width, height));
@@ -255,13 +788,140 @@ void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, c
 
         }
 
-        data += 85;
+        data += OUTPUT_DIMENSIONS;
+
+    }
+}
+
+//*****************************************************************************************************************************************************************
+
+// Perform Tiled Detection
+
+void detectTiled(cv::Mat &image, std::vector<cv::dnn::Net> &nets, std::vector<Detection> &output, const std::vector<std::string> &className) {
+    const int window = INPUT_WIDTH;
+    const int stride = window - TILE_OVERLAP;
+
+    // The last window is aligned to the far edge rather than hanging over it
+    auto windowStarts = [&](int length) -> std::vector<int> {
+        std::vector<int> starts;
+        for (int start = 0; start + window < length; start += stride) {
+            starts.push_back(start);
+        }
+        starts.push_back(std::max(0, length - window));
+        return starts;
+    };
+
+    std::vector<cv::Rect> windows;
+    for (int y : windowStarts(image.rows)) {
+        for (int x : windowStarts(image.cols)) {
+            windows.push_back(cv::Rect(x, y, std::min(window, image.cols - x), std::min(window, image.rows - y)));
+        }
+    }
+
+    const size_t batches = (windows.size() + INFERENCE_BATCH - 1) / INFERENCE_BATCH;
+    size_t nextBatch = 0;
+
+    std::vector<int> class_ids;
+    std::vector<float> confidences;
+    std::vector<cv::Rect> boxes;
+    std::mutex mutex;
+    std::exception_ptr error;
+
+    // Each thread owns one network, cv::dnn::Net is not safe to share
+    auto worker = [&](cv::dnn::Net &net) {
+        try {
+            std::vector<int> local_class_ids;
+            std::vector<float> local_confidences;
+            std::vector<cv::Rect> local_boxes;
+            bool batched = true;
+
+            while (true) {
+                size_t batch;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (nextBatch >= batches) {
+                        break;
+                    }
+                    batch = nextBatch++;
+                }
+
+                const size_t first = batch * INFERENCE_BATCH;
+                const size_t count = std::min(INFERENCE_BATCH, windows.size() - first);
+
+                // Windows at the image border are padded to the full input size, so every window maps 1:1 onto the network input
+                std::vector<cv::Mat> inputs;
+                for (size_t k = 0; k < count; ++k) {
+                    const cv::Rect &rect = windows[first + k];
+                    cv::Mat input = cv::Mat::zeros(window, window, CV_8UC3);
+                    image(rect).copyTo(input(cv::Rect(0, 0, rect.width, rect.height)));
+                    inputs.push_back(input);
+                }
+
+                std::vector<cv::Mat> outputs;
+                if (batched) {
+                    try {
+                        cv::Mat blob;
+                        cv::dnn::blobFromImages(inputs, blob, 1./255., cv::Size(INPUT_WIDTH, INPUT_HEIGHT), cv::Scalar(), true, false);
+                        net.setInput(blob);
+                        net.forward(outputs, net.getUnconnectedOutLayersNames());
+                    } catch (const cv::Exception &) {
+                        // Models exported with a fixed batch size of 1 reject batched input, so this network runs one window at a time from here on
+                        batched = false;
+                    }
+
+                    // Some fixed-batch models accept the blob but return a single frame, which must not be read as count frames
+                    if (batched && (outputs.empty() || outputs[0].size[0] != int(count) || outputs[0].total() != count * OUTPUT_ROWS * OUTPUT_DIMENSIONS)) {
+                        batched = false;
+                    }
+                }
+
+                for (size_t k = 0; k < count; ++k) {
+                    const float *data;
+                    if (batched) {
+                        data = (float *)outputs[0].data + k * OUTPUT_ROWS * OUTPUT_DIMENSIONS;
+                    } else {
+                        cv::Mat blob;
+                        cv::dnn::blobFromImage(inputs[k], blob, 1./255., cv::Size(INPUT_WIDTH, INPUT_HEIGHT), cv::Scalar(), true, false);
+                        net.setInput(blob);
+                        net.forward(outputs, net.getUnconnectedOutLayersNames());
+                        if (outputs.empty() || outputs[0].total() < size_t(OUTPUT_ROWS * OUTPUT_DIMENSIONS)) {
+                            throw std::runtime_error("Unexpected detection output shape");
+                        }
+                        data = (float *)outputs[0].data;
+                    }
+                    collectDetections(data, 1.0, 1.0, windows[first + k].tl(), className, local_class_ids, local_confidences, local_boxes);
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            class_ids.insert(class_ids.end(), local_class_ids.begin(), local_class_ids.end());
+            confidences.insert(confidences.end(), local_confidences.begin(), local_confidences.end());
+            boxes.insert(boxes.end(), local_boxes.begin(), local_boxes.end());
+        } catch (...) {
+            // An exception escaping a std::thread terminates the process, so the first one is handed back to the caller and the remaining batches are dropped
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            nextBatch = batches;
+        }
+    };
 
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::min(nets.size(), batches); ++t) {
+        threads.push_back(std::thread(worker, std::ref(nets[t])));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
     }
 
+    // Cross-tile NMS removes the duplicates that overlapping windows produce
     std::vector<int> nms_result;
     cv::dnn::NMSBoxes(boxes, confidences, SCORE_THRESHOLD, NMS_THRESHOLD, nms_result);
-    for (int i = 0; i < nms_result.size(); i++) {
+    for (size_t i = 0; i < nms_result.size(); i++) {
         int idx = nms_result[i];
         Detection result;
         result.class_id = class_ids[idx];
@@ -275,28 +935,18 @@ void detect(cv::Mat &image, cv::dnn::Net &net, std::vector<Detection> &output, c
 
 // Generate Metadata
 
-const std::string aiGen(const std::string& imagePath)
+const std::string aiGen(const cv::Mat& image, std::vector<cv::dnn::Net>& nets, const std::vector<std::string>& class_list, std::vector<float>* embedding)
 {
-
-	std::vector<std::string> class_list = load_class_list();
-
-	cv::Mat frame;
-
-	bool is_cuda = 0;
-
-	cv::dnn::Net net;
-	load_net(net, is_cuda);
-
-
-	frame = cv::imread(imagePath);
-
-	if (frame.empty())
-	{
-		std::cerr << "Error loading image: " << imagePath << "\n";
-	}
+	// The frame is shared with the ADIOS writer, so it is only ever read here
+	cv::Mat frame = toInferenceImage(image);
 
         std::vector<Detection> output;
-        detect(frame, net, output, class_list);
+        if (std::max(frame.rows, frame.cols) > TILED_MIN_SIZE) {
+            // Squashing a large image to 640x640 loses small objects, so it is run as overlapping windows instead
+            detectTiled(frame, nets, output, class_list);
+        } else {
+            detect(frame, nets[0], output, class_list, embedding);
+        }
 
         int detections = output.size();
 
@@ -304,17 +954,7 @@ const std::string aiGen(const std::string& imagePath)
 
         for (int i = 0; i < detections; ++i)
         {
-
-            auto detection = output[i];
-            auto box = detection.box;
-            auto classId = detection.class_id;
-            const auto color = colors[classId % colors.size()];
-            cv::rectangle(frame, box, color, 3);
-
-            cv::rectangle(frame, cv::Point(box.x, box.y - 20), cv::Point(box.x + box.width, box.y), color, cv::FILLED);
-            cv::putText(frame, class_list[classId].c_str(), cv::Point(box.x, box.y - 5), cv::FONT_HERSHEY_SIMPLEX, 0.5, cv::Scalar(0, 0, 0));
-
-	    out = class_list[classId].c_str();
+	    out = class_list[output[i].class_id];
         }
     std::cout << "Class: " << out << "\n";
 
@@ -324,205 +964,2875 @@ const std::string aiGen(const std::string& imagePath)
 
 //*****************************************************************************************************************************************************************
 
-// Convert Images to BP Format
+// Convert to Inference Image
 
-ConversionResult convert_images(const std::string& experimentName, const std::string& rawPath) {
-	int rank, size;
-	rank = 0;
-	size = 1;
-	
-	// Initializes ADIOS Object
-	
-	adios2::ADIOS adios;
-	adios2::IO bpIO = adios.DeclareIO("image_write");
-	bpIO.SetEngine("bp3");
+cv::Mat toInferenceImage(const cv::Mat& image) {
+	if (image.type() == CV_8UC3) {
+		return image;
+	}
 
-	// Checks if rawpath exists
-	
-	if (!fs::exists(rawPath) || !fs::is_directory(rawPath)) {
-		std::cout << "Error: The specified path does not exist or is not a directory." << std::endl;
-		return {"Error","Error"};
+	// Scientific data rarely fills the full range of its type, so it is stretched to 8 bits rather than scaled
+	cv::Mat converted = image;
+	if (image.depth() != CV_8U) {
+		cv::normalize(image, converted, 0, 255, cv::NORM_MINMAX, CV_8U);
 	}
 
-	// Defines the output path and opens a .bp file at that location using ADIOS
-	
-	std::string outputPath = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/" + experimentName + "/images.bp";
-	adios2::Engine bpFileWriter = bpIO.Open(outputPath, adios2::Mode::Write);
+	// Grey with alpha keeps only its grey channel
+	if (converted.channels() == 2) {
+		cv::Mat gray;
+		cv::extractChannel(converted, gray, 0);
+		converted = gray;
+	}
 
-	// Collects all fileNames in rawpath
-	std::vector<std::string> fileNames;
-	for (const auto& entry : fs::directory_iterator(rawPath)) {
-		if (fs::is_regular_file(entry.status())) {
-		    fileNames.push_back(entry.path().filename());
-		}
+	if (converted.channels() == 1) {
+		cv::cvtColor(converted, converted, cv::COLOR_GRAY2BGR);
+	} else if (converted.channels() == 4) {
+		cv::cvtColor(converted, converted, cv::COLOR_BGRA2BGR);
 	}
 
-	// Iterates through those fileNames, reads data and creates a variable for each image inside the .bp file
-	bool found = false;
+	return converted;
+}
 
-	for (const auto& fileName : fileNames) {
-	        if (fileName == "metadata.txt") {
-	        	found = true;
-	        	continue;
-	        }
+//*****************************************************************************************************************************************************************
 
-		std::string imagePath = rawPath + fileName;
-		cv::Mat image = cv::imread(imagePath);
+// Perceptual Hash
 
-		if (image.empty()) {
-		    std::cerr << "Error: Couldn't open or read the image at " << imagePath << std::endl;
-		return {"Error","Error"};
-		}
+uint64_t perceptualHash(const cv::Mat& image) {
+	// The frame is shrunk to 32x32 before anything else, so no full size copy is made whatever its depth and channels
+	cv::Mat source = image;
+	if (image.depth() == CV_8S || image.depth() == CV_32S) {
+		// The only depths cv::resize does not take
+		image.convertTo(source, CV_32F);
+	}
 
-		if (image.channels() == 1) {
-		    cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
-		}
+	cv::Mat small, gray, frequencies;
+	cv::resize(source, small, cv::Size(32, 32), 0, 0, cv::INTER_AREA);
+	small.convertTo(small, CV_32F);
 
-		const int height = image.rows;
-		const int width = image.cols;
-		const int channels = image.channels();
+	// Bits only compare coefficients with their median, so the value range needs no normalising
+	switch (small.channels()) {
+	case 1: gray = small; break;
+	case 2: cv::extractChannel(small, gray, 0); break;
+	case 3: cv::cvtColor(small, gray, cv::COLOR_BGR2GRAY); break;
+	default: cv::cvtColor(small, gray, cv::COLOR_BGRA2GRAY); break;
+	}
+	cv::dct(gray, frequencies);
 
-		auto ioImage = bpIO.DefineVariable<uint8_t>(fileName, {size * height, width, channels}, {rank * height, 0, 0}, {height, width, channels}, false);
-	
-		std::cout << "Writing " << fileName << std::endl;
-		bpFileWriter.Put(ioImage, image.data, adios2::Mode::Sync);
+	// The 8x8 lowest frequencies carry the image structure, each bit says whether one lies above their median
+	std::vector<float> low;
+	for (int y = 0; y < 8; ++y) {
+		for (int x = 0; x < 8; ++x) {
+			low.push_back(frequencies.at<float>(y, x));
+		}
 	}
 
-    	if(!found) {
-		std::string metadataFilePath = rawPath + "metadata.txt";
-		std::ifstream metadataFile(metadataFilePath);
-		std::string metadataContent = "";
+	// The DC term only reflects brightness, so it is left out of the median
+	std::vector<float> sorted(low.begin() + 1, low.end());
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+	const float median = sorted[sorted.size() / 2];
 
-		bool validChoice = false;
-
-		do {
-			std::cout << "\nMetadata File Not Found!\nSelect an option below:\n";
-			std::cout << "1) Use empty metadata file\n2) AI generate metadata based on images\n3) Add custom metadata file content\nSelect a choice (1/2/3): ";
-
-			int userChoice;
-			std::cin >> userChoice;
-			std::ofstream metadataFile(metadataFilePath);  // Reopen the file stream
-			switch (userChoice) {
-			case 1:
-				metadataContent = "";
-				validChoice = true;
-				
-				if (metadataFile.is_open()) {
-					metadataFile << metadataContent;
-					std::cout << "Empty metadata File created and content written successfully!" << std::endl;
-				} else {
-					std::cerr << "Error creating/writing metadata file!" << std::endl;
-				}
-										
-				break;
-			case 2:
-				// AI generate metadata based on images
-				// Implement AI generation logic here if needed
-				// metadataContent = generateMetadataAI();
-				metadataContent = "";
-				
-				validChoice = true;
-
-				for (const auto& fileName : fileNames) {
-				std::string img_loc = "/home/pbhatia4/Desktop/Adios2C-Implementation/Data-Input/" + experimentName + "/" + fileName;	
-				std::string classification = aiGen(img_loc); // Assuming aiGen takes filename as input and returns classification as string
-				metadataContent += fileName + ": " + classification + "\n";
-				}
-				
-				if (metadataFile.is_open()) {
-					metadataFile << metadataContent;
-					std::cout << "Empty metadata File created and content written successfully!" << std::endl;
-				} else {
-					std::cerr << "Error creating/writing metadata file!" << std::endl;
-				}
-				break;
-			case 3:
-				std::cout << "Enter custom metadata content: ";
-				std::cin.ignore();  // Clear input buffer
-				std::getline(std::cin, metadataContent);
-				validChoice = true;
-
-				if (metadataFile.is_open()) {
-					metadataFile << metadataContent;
-					std::cout << "\nCustom metadata File created and content written successfully!" << std::endl;
-				} else {
-					std::cerr << "Error creating/writing metadata file!" << std::endl;
-				}
+	uint64_t hash = 0;
+	for (size_t i = 0; i < low.size(); ++i) {
+		if (low[i] > median) {
+			hash |= uint64_t(1) << i;
+		}
+	}
+	return hash;
+}
 
-				break;
-			default:
-				std::cerr << "Invalid choice. Please enter a valid choice." << std::endl;
-			}
-			metadataFile.close();  // Close the file stream after writing					
-		} while (!validChoice);   	
-    	}
+//*****************************************************************************************************************************************************************
 
-	fileNames.clear();
+// Compute Embedding
 
-	for (const auto& entry : fs::directory_iterator(rawPath)) {
-		if (fs::is_regular_file(entry.status())) {
-		    fileNames.push_back(entry.path().filename());
+std::vector<float> computeEmbedding(const cv::Mat& image, cv::dnn::Net& net) {
+	cv::Mat blob;
+	cv::dnn::blobFromImage(format_yolov5(toInferenceImage(image)), blob, 1./255., cv::Size(INPUT_WIDTH, INPUT_HEIGHT), cv::Scalar(), true, false);
+	net.setInput(blob);
+	return poolEmbedding(net.forward(EMBEDDING_LAYER));
+}
+
+std::vector<float> poolEmbedding(const cv::Mat& features) {
+	// Activations are {1, channels, height, width}, pooled over the spatial dimensions
+	const size_t featureChannels = features.size[1];
+	const size_t spatial = features.total() / featureChannels;
+	const float* data = features.ptr<float>();
+
+	std::vector<float> embedding(featureChannels, 0.0f);
+	double norm = 0;
+	for (size_t c = 0; c < featureChannels; ++c) {
+		for (size_t i = 0; i < spatial; ++i) {
+			embedding[c] += data[c * spatial + i];
 		}
+		embedding[c] /= spatial;
+		norm += embedding[c] * embedding[c];
 	}
 
-	std::string metadataContent = "";
-	for (const auto& fileName : fileNames) {
-		if (fileName == "metadata.txt") {
-			std::string metadataFilePath = rawPath + "metadata.txt";
-			std::ifstream metadataFile(metadataFilePath);
-			if (metadataFile.is_open()) {
-				std::stringstream buffer;
-				buffer << metadataFile.rdbuf();
-				metadataContent = buffer.str();
-				std::cout << "\nFound Metadata!\nMetadata Content: \n" << metadataContent << std::endl;
-				adios2::Attribute<std::string> metadataAttribute = bpIO.DefineAttribute<std::string>("metadata", metadataContent);
-				metadataFile.close();  // Close the file stream				
-			}
-	
+	norm = std::sqrt(norm);
+	if (norm > 0) {
+		for (auto& value : embedding) {
+			value /= norm;
 		}
-	}	
+	}
+	return embedding;
+}
 
-    
-	bpFileWriter.Close();
-	return {outputPath, metadataContent};
+bool hasEmbeddingLayer(const cv::dnn::Net& net) {
+	if (EMBEDDING_LAYER.empty()) {
+		return false;
+	}
+
+	if (net.getLayerId(EMBEDDING_LAYER) < 0) {
+		std::cerr << "Error: EMBEDDING_LAYER " << EMBEDDING_LAYER << " is not a layer of the network, embeddings are disabled" << std::endl;
+		return false;
+	}
+	return true;
 }
 
 //*****************************************************************************************************************************************************************
 
-// Insert Data To SQLite Database
+// Metadata Generator
 
-void insertDataToDatabase(const std::string& authorName, const std::string& experimentName, const std::string& adiosOutputPath, const std::string& metadataContent) {
+MetadataGenerator::MetadataGenerator() : class_list(load_class_list()), nets(INFERENCE_THREADS) {
+	bool is_cuda = 0;
+	for (auto& net : nets) {
+		load_net(net, is_cuda);
+	}
+	computeEmbeddings = hasEmbeddingLayer(nets[0]);
 
-	// Purpose is to store authorName, experimentName, adiosOutputPath inside the database
-	
-	sqlite3* db;
-	int rc = sqlite3_open("data.db", &db);
+	thread = std::thread(&MetadataGenerator::worker, this);
+}
+
+MetadataGenerator::~MetadataGenerator() {
+	finish();
+}
+
+void MetadataGenerator::submit(const std::string& fileName, const cv::Mat& frame) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Bounded so that a slow network does not make ingest hold every decoded frame in memory
+	changed.wait(lock, [this] { return pending.size() < METADATA_QUEUE_DEPTH; });
+	pending.push_back(std::make_pair(fileName, frame));
+	changed.notify_all();
+}
+
+std::map<std::string, std::string> MetadataGenerator::finish() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		finished = true;
+	}
+	changed.notify_all();
+
+	if (thread.joinable()) {
+		thread.join();
+	}
+	return classifications;
+}
+
+const std::map<std::string, std::vector<float>>& MetadataGenerator::embeddings() const {
+	return frameEmbeddings;
+}
+
+void MetadataGenerator::worker() {
+	while (true) {
+		std::pair<std::string, cv::Mat> item;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this] { return finished || !pending.empty(); });
+			if (pending.empty()) {
+				break;
+			}
+			item = pending.front();
+			pending.pop_front();
+		}
+		changed.notify_all();
+
+		// A frame the networks reject is recorded as an error, the queue keeps draining so submit() never blocks on a dead worker
+		std::string classification;
+		std::vector<float> embedding;
+		try {
+			classification = aiGen(item.second, nets, class_list, computeEmbeddings ? &embedding : nullptr);
+		} catch (const std::exception& e) {
+			std::cerr << "Error: Detection failed for " << item.first << ": " << e.what() << std::endl;
+			classification = "error";
+		}
+
+		// Tiled frames have no whole-frame detection pass to share, so only they run a forward pass of their own for the embedding
+		if (computeEmbeddings && embedding.empty()) {
+			try {
+				embedding = computeEmbedding(item.second, nets[0]);
+			} catch (const std::exception& e) {
+				std::cerr << "Error: Embedding failed for " << item.first << ": " << e.what() << std::endl;
+				embedding.clear();
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		classifications[item.first] = classification;
+		frameEmbeddings[item.first] = embedding;
+	}
+}
+
+//*****************************************************************************************************************************************************************
+
+// Typed Image Variables
+
+template <class T>
+void putTypedImage(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& variableName, const adios2::Dims& shape, const adios2::Dims& start, const adios2::Dims& count, const void* data) {
+	// Tiles and group frames Put several blocks into one variable, only the first one defines it
+	adios2::Variable<T> variable = bpIO.InquireVariable<T>(variableName);
+	if (!variable) {
+		variable = bpIO.DefineVariable<T>(variableName, shape, start, count, false);
+	} else {
+		variable.SetSelection({start, count});
+	}
+	bpFileWriter.Put(variable, static_cast<const T*>(data), adios2::Mode::Sync);
+}
+
+bool putImageData(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& variableName, int depth, const adios2::Dims& shape, const adios2::Dims& start, const adios2::Dims& count, const void* data) {
+	switch (depth) {
+	case CV_8U: putTypedImage<uint8_t>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_8S: putTypedImage<int8_t>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_16U: putTypedImage<uint16_t>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_16S: putTypedImage<int16_t>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_32S: putTypedImage<int32_t>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_32F: putTypedImage<float>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	case CV_64F: putTypedImage<double>(bpIO, bpFileWriter, variableName, shape, start, count, data); return true;
+	default:
+		std::cerr << "Error: Unsupported pixel depth for " << variableName << std::endl;
+		return false;
+	}
+}
+
+template <class T>
+void getTypedImage(adios2::IO& bpIO, adios2::Engine& bpReader, const std::string& variableName, const adios2::Dims& start, const adios2::Dims& count, void* data) {
+	adios2::Variable<T> variable = bpIO.InquireVariable<T>(variableName);
+	variable.SetSelection({start, count});
+	bpReader.Get(variable, static_cast<T*>(data), adios2::Mode::Sync);
+}
+
+bool getImageData(adios2::IO& bpIO, adios2::Engine& bpReader, const std::string& variableName, int depth, const adios2::Dims& start, const adios2::Dims& count, void* data) {
+	switch (depth) {
+	case CV_8U: getTypedImage<uint8_t>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_8S: getTypedImage<int8_t>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_16U: getTypedImage<uint16_t>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_16S: getTypedImage<int16_t>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_32S: getTypedImage<int32_t>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_32F: getTypedImage<float>(bpIO, bpReader, variableName, start, count, data); return true;
+	case CV_64F: getTypedImage<double>(bpIO, bpReader, variableName, start, count, data); return true;
+	default:
+		std::cerr << "Error: Unsupported pixel depth for " << variableName << std::endl;
+		return false;
+	}
+}
+
+template <class T>
+adios2::Dims typedImageShape(adios2::IO& bpIO, const std::string& variableName) {
+	return bpIO.InquireVariable<T>(variableName).Shape();
+}
+
+bool inquireImageVariable(adios2::IO& bpIO, const std::string& variableName, int& depth, adios2::Dims& shape) {
+	const std::string type = bpIO.VariableType(variableName);
+
+	if (type == adios2::GetType<uint8_t>()) {
+		depth = CV_8U;
+		shape = typedImageShape<uint8_t>(bpIO, variableName);
+	} else if (type == adios2::GetType<int8_t>()) {
+		depth = CV_8S;
+		shape = typedImageShape<int8_t>(bpIO, variableName);
+	} else if (type == adios2::GetType<uint16_t>()) {
+		depth = CV_16U;
+		shape = typedImageShape<uint16_t>(bpIO, variableName);
+	} else if (type == adios2::GetType<int16_t>()) {
+		depth = CV_16S;
+		shape = typedImageShape<int16_t>(bpIO, variableName);
+	} else if (type == adios2::GetType<int32_t>()) {
+		depth = CV_32S;
+		shape = typedImageShape<int32_t>(bpIO, variableName);
+	} else if (type == adios2::GetType<float>()) {
+		depth = CV_32F;
+		shape = typedImageShape<float>(bpIO, variableName);
+	} else if (type == adios2::GetType<double>()) {
+		depth = CV_64F;
+		shape = typedImageShape<double>(bpIO, variableName);
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Probe Image Shape
+
+bool probeImageShape(const std::string& imagePath, int& height, int& width, int& channels, int& depth) {
+	std::ifstream file(imagePath, std::ios::binary);
+	unsigned char header[26];
+	if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) {
+		return false;
+	}
+
+	auto bigEndian16 = [](const unsigned char* bytes) { return (bytes[0] << 8) | bytes[1]; };
+	auto bigEndian32 = [](const unsigned char* bytes) { return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) | (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]); };
+
+	// PNG: the IHDR chunk always comes first and holds width, height, bit depth and colour type
+	const unsigned char pngSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	if (std::equal(pngSignature, pngSignature + 8, header)) {
+		// PNG allows up to 2^31-1 in each dimension, anything larger is a corrupt header
+		const uint32_t pngWidth = bigEndian32(header + 16);
+		const uint32_t pngHeight = bigEndian32(header + 20);
+		if (pngWidth == 0 || pngHeight == 0 || pngWidth > uint32_t(INT_MAX) || pngHeight > uint32_t(INT_MAX)) {
+			return false;
+		}
+		width = pngWidth;
+		height = pngHeight;
+		depth = (header[24] == 16) ? CV_16U : CV_8U;
+
+		// Palette images decode to BGR and grey with alpha to BGRA
+		switch (header[25]) {
+		case 0: channels = 1; break;
+		case 2: channels = 3; break;
+		case 3: channels = 3; break;
+		case 4: channels = 4; break;
+		case 6: channels = 4; break;
+		default: return false;
+		}
+		return true;
+	}
+
+	// JPEG: walk the marker segments until the start of frame
+	if (header[0] != 0xFF || header[1] != 0xD8) {
+		return false;
+	}
+
+	file.seekg(2);
+	unsigned char segment[8];
+	while (file.read(reinterpret_cast<char*>(segment), 4)) {
+		if (segment[0] != 0xFF) {
+			return false;
+		}
+
+		const unsigned char marker = segment[1];
+		if (marker == 0xFF) {
+			// Fill byte, the marker starts one byte later
+			file.seekg(-3, std::ios::cur);
+			continue;
+		}
+
+		const int length = bigEndian16(segment + 2);
+		const bool startOfFrame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+		if (startOfFrame) {
+			if (!file.read(reinterpret_cast<char*>(segment), 6)) {
+				return false;
+			}
+			height = bigEndian16(segment + 1);
+			width = bigEndian16(segment + 3);
+			channels = segment[5];
+			depth = CV_8U;
+			return height > 0 && width > 0;
+		}
+
+		file.seekg(length - 2, std::ios::cur);
+	}
+
+	return false;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Group Variable Name
+
+std::string groupVariableName(size_t height, size_t width, size_t channels, int depth) {
+	const char* depthSuffixes[] = {"", "_8s", "_16u", "_16s", "_32s", "_32f", "_64f", "_16f"};
+	return "group_" + std::to_string(height) + "x" + std::to_string(width) + "x" + std::to_string(channels) + depthSuffixes[depth & 7];
+}
+
+//*****************************************************************************************************************************************************************
+
+// Write Tiled Image
+
+void writeTiledImage(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& fileName, const cv::Mat& image, int tileSize) {
+	const size_t height = image.rows;
+	const size_t width = image.cols;
+	const size_t channels = image.channels();
+	const size_t tile = tileSize;
+
+	// The variable keeps the full image shape; every Put below adds one block at the tile's offset
+	bpIO.DefineAttribute<int>(fileName + "/tile_size", tileSize);
+
+	// Tiles are staged through one reused buffer since ROIs of the decoded image are not contiguous
+	cv::Mat tileImage;
+	for (size_t y = 0; y < height; y += tile) {
+		for (size_t x = 0; x < width; x += tile) {
+			const size_t tileHeight = std::min(tile, height - y);
+			const size_t tileWidth = std::min(tile, width - x);
+
+			image(cv::Rect(x, y, tileWidth, tileHeight)).copyTo(tileImage);
+			putImageData(bpIO, bpFileWriter, fileName, image.depth(), {height, width, channels}, {y, x, 0}, {tileHeight, tileWidth, channels}, tileImage.data);
+		}
+	}
+}
+
+//*****************************************************************************************************************************************************************
+
+// Image Pyramid
+
+const int THUMBNAIL_SIZE = 256;
+
+std::vector<cv::Mat> buildPyramid(const cv::Mat& image) {
+	std::vector<cv::Mat> levels;
+	cv::Mat current = image;
+
+	while (std::max(current.rows, current.cols) > THUMBNAIL_SIZE) {
+		cv::Mat next;
+		cv::pyrDown(current, next);
+		levels.push_back(next);
+		current = next;
+	}
+
+	return levels;
+}
+
+void writePyramid(adios2::IO& bpIO, adios2::Engine& bpFileWriter, const std::string& prefix, const std::string& fileName, const cv::Mat& image, const std::vector<cv::Mat>& levels, int tileSize) {
+	// Levels larger than a tile are tiled like the full image, so region reads on a level stay cheap and no block grows to gigabytes
+	auto writeLevel = [&](const std::string& variableName, const cv::Mat& level) {
+		const size_t height = level.rows;
+		const size_t width = level.cols;
+		const size_t channels = level.channels();
+
+		if (tileSize > 0 && (level.rows > tileSize || level.cols > tileSize)) {
+			writeTiledImage(bpIO, bpFileWriter, variableName, level, tileSize);
+		} else {
+			putImageData(bpIO, bpFileWriter, variableName, level.depth(), {height, width, channels}, {0, 0, 0}, {height, width, channels}, level.data);
+		}
+	};
+
+	for (size_t k = 0; k < levels.size(); ++k) {
+		// The last level is stored as the thumbnail, so every image has exactly one
+		writeLevel(prefix + ((k + 1 == levels.size()) ? "thumbnail/" + fileName : "pyramid/L" + std::to_string(k + 1) + "/" + fileName), levels[k]);
+	}
+
+	// Images that already fit are their own thumbnail
+	if (levels.empty()) {
+		writeLevel(prefix + "thumbnail/" + fileName, image);
+	}
+}
+
+std::string levelVariableName(const std::map<std::string, adios2::Params>& variables, const std::string& fileName, int level) {
+	const std::string pyramidName = "pyramid/L" + std::to_string(level) + "/" + fileName;
+	if (level > 0 && variables.count(pyramidName)) {
+		return pyramidName;
+	}
+	return "thumbnail/" + fileName;
+}
+
+bool isDerivedVariable(const std::string& variableName) {
+	return variableName.compare(0, 8, "pyramid/") == 0 || variableName.compare(0, 10, "thumbnail/") == 0;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Convert Images to BP Format
+
+ConversionResult convert_images(const std::string& experimentName, const std::string& rawPath, const ConversionOptions& options) {
+	int rank, size;
+	rank = 0;
+	size = 1;
+	
+	// Initializes ADIOS Object
+	
+	adios2::ADIOS adios;
+	adios2::IO bpIO = adios.DeclareIO("image_write");
+	bpIO.SetEngine("bp3");
+
+	// Checks if rawpath exists
+	
+	if (!fs::exists(rawPath) || !fs::is_directory(rawPath)) {
+		std::cout << "Error: The specified path does not exist or is not a directory." << std::endl;
+		return {"Error", "Error", {}, 0};
+	}
+
+	// Defines the output path and opens a .bp file at that location using ADIOS
+	
+	std::string outputPath = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/" + experimentName + "/images.bp";
+	// A container ingest writes BP4 to a staging file of its own, which is copied into the container afterwards under the container's lock
+	if (!options.containerPath.empty()) {
+		outputPath = options.containerPath;
+		bpIO.SetEngine("bp4");
+	}
+
+	adios2::Engine bpFileWriter = bpIO.Open(outputPath, adios2::Mode::Write);
+	const std::string& prefix = options.variablePrefix;
+
+	// Collects all fileNames in rawpath
+	std::vector<std::string> fileNames;
+	for (const auto& entry : fs::directory_iterator(rawPath)) {
+		if (fs::is_regular_file(entry.status())) {
+		    fileNames.push_back(entry.path().filename());
+		}
+	}
+
+	// Shapes are probed from the file headers up front, since a group variable needs its frame count before the first frame is written
+	std::map<std::string, ImageGroup> groups;
+	std::map<std::string, std::pair<std::string, size_t>> groupSlots;
+
+	if (options.groupByShape) {
+		std::map<std::string, std::vector<std::string>> members;
+		for (const auto& fileName : fileNames) {
+			int height, width, channels, depth;
+			if (fileName == "metadata.txt" || !probeImageShape(rawPath + fileName, height, width, channels, depth)) {
+				continue;
+			}
+			if (options.tileSize > 0 && (height > options.tileSize || width > options.tileSize)) {
+				continue;
+			}
+			members[prefix + groupVariableName(height, width, channels, depth)].push_back(fileName);
+		}
+
+		for (const auto& member : members) {
+			// A group of one gains nothing over a plain variable
+			if (member.second.size() < 2) {
+				continue;
+			}
+
+			int height, width, channels, depth;
+			probeImageShape(rawPath + member.second[0], height, width, channels, depth);
+
+			ImageGroup& group = groups[member.first];
+			group.height = height;
+			group.width = width;
+			group.channels = channels;
+			group.depth = depth;
+			group.names.resize(member.second.size());
+
+			for (size_t slot = 0; slot < member.second.size(); ++slot) {
+				groupSlots[member.second[slot]] = std::make_pair(member.first, slot);
+			}
+		}
+	}
+
+	// The metadata choice is made before ingest, so that AI metadata is generated from the frames as they are decoded for the BP write
+	bool found = std::find(fileNames.begin(), fileNames.end(), "metadata.txt") != fileNames.end();
+	int metadataChoice = 0;
+	std::unique_ptr<MetadataGenerator> metadataGenerator;
+
+	if (!found) {
+		metadataChoice = options.metadataChoice > 0 ? options.metadataChoice : 1;
+		if (metadataChoice == 2) {
+			metadataGenerator.reset(new MetadataGenerator());
+		}
+	}
+
+	// Iterates through those fileNames, reads data and creates a variable for each image inside the .bp file
+	auto ingestStart = std::chrono::steady_clock::now();
+	std::vector<ImageHash> hashes;
+	size_t storedBytes = 0;
+	size_t bgrBytes = 0;
+	size_t levelBytes = 0;
+
+	for (const auto& fileName : fileNames) {
+	        if (fileName == "metadata.txt") {
+	        	continue;
+	        }
+
+		// Read with the file's own channel count and bit depth instead of forcing 8-bit BGR
+		std::string imagePath = rawPath + fileName;
+
+		// OpenCV returns an empty Mat for images over its pixel limit, which is reported as such rather than as an unreadable file
+		const char* limitSetting = std::getenv("OPENCV_IO_MAX_IMAGE_PIXELS");
+		const uint64_t decodeLimit = limitSetting ? std::strtoull(limitSetting, nullptr, 10) : uint64_t(1) << 30;
+		int probedHeight, probedWidth, probedChannels, probedDepth;
+		const bool tooLarge = probeImageShape(imagePath, probedHeight, probedWidth, probedChannels, probedDepth) && uint64_t(probedHeight) * uint64_t(probedWidth) > decodeLimit;
+
+		cv::Mat image;
+		if (tooLarge) {
+		    std::cerr << "Error: " << imagePath << " has " << uint64_t(probedHeight) * uint64_t(probedWidth) << " pixels, over the decoder limit OPENCV_IO_MAX_IMAGE_PIXELS=" << decodeLimit << std::endl;
+		} else {
+		    image = cv::imread(imagePath, cv::IMREAD_UNCHANGED);
+		}
+
+		if (image.empty()) {
+		    if (!tooLarge) {
+		        std::cerr << "Error: Couldn't open or read the image at " << imagePath << std::endl;
+		    }
+
+		bpFileWriter.Close();
+		return {"Error", "Error", {}, 0};
+		}
+
+		// Detection reads the same decoded frame, shared by reference, while it is written below
+		if (metadataGenerator) {
+			metadataGenerator->submit(fileName, image);
+		}
+
+		ImageHash imageHash;
+		imageHash.fileName = fileName;
+		imageHash.phash = perceptualHash(image);
+		hashes.push_back(imageHash);
+
+		storedBytes += image.total() * image.elemSize();
+		bgrBytes += image.total() * 3;
+
+		const int height = image.rows;
+		const int width = image.cols;
+		const int channels = image.channels();
+
+		// Downsampled levels are computed on a second thread while the full resolution image is being written
+		std::vector<cv::Mat> levels;
+		std::thread pyramidThread;
+		if (options.pyramid) {
+			pyramidThread = std::thread([&image, &levels] { levels = buildPyramid(image); });
+		}
+
+		bool written = false;
+		auto groupSlot = groupSlots.find(fileName);
+
+		if (options.tileSize > 0 && (height > options.tileSize || width > options.tileSize)) {
+			std::cout << "Writing " << fileName << " as " << options.tileSize << "x" << options.tileSize << " tiles" << std::endl;
+			writeTiledImage(bpIO, bpFileWriter, prefix + fileName, image, options.tileSize);
+			written = true;
+		} else if (groupSlot != groupSlots.end()) {
+			ImageGroup& group = groups[groupSlot->second.first];
+			const size_t slot = groupSlot->second.second;
+
+			// The decoded shape can differ from the header, e.g. for EXIF rotated JPEGs; such images fall back to their own variable
+			if (size_t(height) == group.height && size_t(width) == group.width && size_t(channels) == group.channels && image.depth() == group.depth) {
+				std::cout << "Writing " << fileName << " into " << groupSlot->second.first << "[" << slot << "]" << std::endl;
+				putImageData(bpIO, bpFileWriter, groupSlot->second.first, group.depth, {group.names.size(), group.height, group.width, group.channels}, {slot, 0, 0, 0}, {1, group.height, group.width, group.channels}, image.data);
+				group.names[slot] = fileName;
+				written = true;
+			}
+		}
+
+		if (!written) {
+			std::cout << "Writing " << fileName << std::endl;
+			putImageData(bpIO, bpFileWriter, prefix + fileName, image.depth(), {size_t(size * height), size_t(width), size_t(channels)}, {size_t(rank * height), 0, 0}, {size_t(height), size_t(width), size_t(channels)}, image.data);
+		}
+
+		if (pyramidThread.joinable()) {
+			pyramidThread.join();
+			writePyramid(bpIO, bpFileWriter, prefix, fileName, image, levels, options.tileSize);
+
+			for (const auto& level : levels) {
+				levelBytes += level.total() * level.elemSize();
+			}
+			if (levels.empty()) {
+				levelBytes += image.total() * image.elemSize();
+			}
+		}
+	}
+
+	for (const auto& group : groups) {
+		// Every member may have fallen back to its own variable, in which case the group was never defined
+		if (bpIO.VariableType(group.first).empty()) {
+			continue;
+		}
+		bpIO.DefineAttribute<std::string>(group.first + "/names", group.second.names.data(), group.second.names.size());
+	}
+
+	std::cout << "\nStored " << storedBytes / (1024.0 * 1024.0) << " MB of pixel data ("
+	          << bgrBytes / (1024.0 * 1024.0) << " MB as 8-bit BGR)" << std::endl;
+
+    	if(!found) {
+		std::string metadataContent = "";
+
+		if (metadataChoice == 2) {
+			// Waits for the frames still queued for detection
+			std::map<std::string, std::string> classifications = metadataGenerator->finish();
+			for (const auto& fileName : fileNames) {
+				metadataContent += fileName + ": " + classifications[fileName] + "\n";
+			}
+			for (auto& imageHash : hashes) {
+				auto embedding = metadataGenerator->embeddings().find(imageHash.fileName);
+				if (embedding != metadataGenerator->embeddings().end()) {
+					imageHash.embedding = embedding->second;
+				}
+			}
+			std::cout << "Ingest with AI metadata took " << std::chrono::duration<double>(std::chrono::steady_clock::now() - ingestStart).count() << " s" << std::endl;
+		} else if (metadataChoice == 3) {
+			metadataContent = options.customMetadata;
+		}
+
+		std::ofstream metadataFile(rawPath + "metadata.txt");
+		if (metadataFile.is_open()) {
+			metadataFile << metadataContent;
+			if (metadataChoice == 1) {
+				std::cout << "Empty metadata File created and content written successfully!" << std::endl;
+			} else if (metadataChoice == 2) {
+				std::cout << "AI generated metadata File created and content written successfully!" << std::endl;
+			} else {
+				std::cout << "\nCustom metadata File created and content written successfully!" << std::endl;
+			}
+		} else {
+			std::cerr << "Error creating/writing metadata file!" << std::endl;
+		}
+		metadataFile.close();
+    	}
+
+	fileNames.clear();
+
+	for (const auto& entry : fs::directory_iterator(rawPath)) {
+		if (fs::is_regular_file(entry.status())) {
+		    fileNames.push_back(entry.path().filename());
+		}
+	}
+
+	std::string metadataContent = "";
+	for (const auto& fileName : fileNames) {
+		if (fileName == "metadata.txt") {
+			std::string metadataFilePath = rawPath + "metadata.txt";
+			std::ifstream metadataFile(metadataFilePath);
+			if (metadataFile.is_open()) {
+				std::stringstream buffer;
+				buffer << metadataFile.rdbuf();
+				metadataContent = buffer.str();
+				std::cout << "\nFound Metadata!\nMetadata Content: \n" << metadataContent << std::endl;
+				adios2::Attribute<std::string> metadataAttribute = bpIO.DefineAttribute<std::string>(prefix + "metadata", metadataContent);
+				metadataFile.close();  // Close the file stream				
+			}
+	
+		}
+	}	
+
+    
+	bpFileWriter.Close();
+	return {outputPath, metadataContent, hashes, storedBytes + levelBytes};
+}
+
+//*****************************************************************************************************************************************************************
+
+// Insert Data To SQLite Database
+
+void insertDataToDatabase(const std::string& authorName, const std::string& experimentName, const std::string& adiosOutputPath, const std::string& metadataContent, const std::string& variablePrefix, size_t storageBytes) {
+
+	// Purpose is to store authorName, experimentName, adiosOutputPath inside the database
+	
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
+
+	// Creates table if it doesnt already exist
+
+	if (!createExperimentTable(db)) {
+		sqlite3_close(db);
+		return;
+	}
+
+	std::string sqlScript = "INSERT INTO experiment_data (author_name, experiment_name, adios_image_path, metadataContent, variable_prefix, storage_bytes, created_at) VALUES (?, ?, ?, ?, ?, ?, strftime('%s', 'now'));";
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, sqlScript.c_str(), -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_text(stmt, 1, authorName.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_text(stmt, 2, experimentName.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_text(stmt, 3, adiosOutputPath.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_text(stmt, 4, metadataContent.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_text(stmt, 5, variablePrefix.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_bind_int64(stmt, 6, storageBytes);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return;
+	}
+
+	rc = sqlite3_step(stmt);
+
+	if (rc != SQLITE_DONE) {
+		std::cerr << "Error: Failed to execute query: " << sqlite3_errmsg(db) << std::endl;
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Catalog Schema
+
+bool createExperimentTable(sqlite3* db) {
+	// The function signature of the sqlite exec API expects 3 additional parameters that we dont need. These are callback function, arg to callback, and an error message
+	std::string createTableQuery = "CREATE TABLE IF NOT EXISTS experiment_data ("
+		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+		                   "author_name TEXT, "
+		                   "experiment_name TEXT UNIQUE, "
+		                   "adios_image_path TEXT,"
+		                   "metadataContent TEXT);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_path ON experiment_data (adios_image_path);"
+		                   "CREATE TABLE IF NOT EXISTS containers ("
+		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+		                   "path TEXT UNIQUE, "
+		                   "slots INTEGER DEFAULT 0);"
+		                   "CREATE TABLE IF NOT EXISTS container_tombstones ("
+		                   "container_path TEXT, "
+		                   "variable_prefix TEXT);"
+		                   "CREATE TABLE IF NOT EXISTS retired_containers ("
+		                   "path TEXT, "
+		                   "retired_at INTEGER);";
+
+	int rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to create table: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	// Columns added since the table was introduced, appended to catalogs created without them
+	const std::vector<std::pair<std::string, std::string>> addedColumns = {
+		{"variable_prefix", "TEXT DEFAULT ''"},
+		{"created_at", "INTEGER DEFAULT 0"},
+		{"storage_bytes", "INTEGER DEFAULT 0"},
+	};
+
+	std::vector<std::string> columns;
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, "PRAGMA table_info(experiment_data);", -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		columns.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+	}
+	sqlite3_finalize(stmt);
+
+	for (const auto& column : addedColumns) {
+		if (std::find(columns.begin(), columns.end(), column.first) != columns.end()) {
+			continue;
+		}
+
+		std::string alterQuery = "ALTER TABLE experiment_data ADD COLUMN " + column.first + " " + column.second + ";";
+		rc = sqlite3_exec(db, alterQuery.c_str(), nullptr, nullptr, nullptr);
+
+		if (rc != SQLITE_OK) {
+			std::cerr << "Error: Failed to add column " << column.first << ": " << sqlite3_errmsg(db) << std::endl;
+			return false;
+		}
+	}
+
+	// One index per catalog query order, alone and under an author filter, with id as the keyset tie-break; name order alone uses the UNIQUE index.
+	// Range filters on a column other than the order are checked against each row the walk passes.
+	std::string createIndexQuery = "CREATE INDEX IF NOT EXISTS experiment_data_created ON experiment_data (created_at, id);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_storage ON experiment_data (storage_bytes, id);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_author_name ON experiment_data (author_name, experiment_name);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_author_created ON experiment_data (author_name, created_at, id);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_author_storage ON experiment_data (author_name, storage_bytes, id);"
+		                   "CREATE INDEX IF NOT EXISTS experiment_data_author_id ON experiment_data (author_name, id);";
+
+	rc = sqlite3_exec(db, createIndexQuery.c_str(), nullptr, nullptr, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to create index: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+bool runStatement(sqlite3* db, const std::string& query, const std::vector<std::string>& values) {
+	sqlite3_stmt* stmt;
+	int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	for (size_t i = 0; i < values.size(); ++i) {
+		sqlite3_bind_text(stmt, i + 1, values[i].c_str(), -1, SQLITE_STATIC);
+	}
+
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_DONE) {
+		std::cerr << "Error: Failed to execute query: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Check DB
+
+bool checkdb(const std::string& experimentName) {
+    sqlite3* db;
+    int exit = 0;
+    exit = sqlite3_open("data.db", &db);
+
+    if (exit) {
+        std::cout << "Error: Can't open database: \n" << sqlite3_errmsg(db) << std::endl;
+        std::exit(0);
+    }
+
+    if (!createExperimentTable(db)) {
+        sqlite3_close(db);
+        std::exit(0);        
+    }
+
+    std::string query = "SELECT experiment_name FROM experiment_data WHERE experiment_name = ?;";
+    sqlite3_stmt* stmt;
+
+    int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+
+    if (rc != SQLITE_OK) {
+        std::cout << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        std::exit(0);        
+    }
+
+    rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+
+    if (rc != SQLITE_OK) {
+        std::cout << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        std::exit(0);        
+    }
+
+    rc = sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    return (rc == SQLITE_ROW);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Retrieve Data from User, Convert Image and Insert Into Database
+
+int chooseMetadata(std::string& customMetadata) {
+	int metadataChoice = 0;
+	bool validChoice = false;
+
+	do {
+		std::cout << "\nMetadata File Not Found!\nSelect an option below:\n";
+		std::cout << "1) Use empty metadata file\n2) AI generate metadata based on images\n3) Add custom metadata file content\nSelect a choice (1/2/3): ";
+
+		std::cin >> metadataChoice;
+		switch (metadataChoice) {
+		case 1:
+		case 2:
+			validChoice = true;
+			break;
+		case 3:
+			std::cout << "Enter custom metadata content: ";
+			std::cin.ignore();  // Clear input buffer
+			std::getline(std::cin, customMetadata);
+			validChoice = true;
+			break;
+		default:
+			std::cerr << "Invalid choice. Please enter a valid choice." << std::endl;
+		}
+	} while (!validChoice);
+
+	return metadataChoice;
+}
+
+void insertDataAndGetPath() {
+	std::string experimentName;
+	std::string rawImagesPath;
+	std::string authorName;
+
+	std::cout << "Enter Experiment Name: ";
+	std::cin >> experimentName;
+
+	if (checkdb(experimentName)) {
+		std::cout << "Experiment already exists in the database!" << std::endl;
+		return;
+	}
+
+	std::cout << "Enter Author Name: ";
+	std::cin >> authorName;
+
+	std::cout << "Enter path to the directory containing raw images: ";
+	std::cin >> rawImagesPath;
+
+	ConversionOptions options;
+	std::cout << "Enter tile size for large images (0 to store images whole): ";
+	std::cin >> options.tileSize;
+
+	std::string groupChoice;
+	std::cout << "Group identically sized images into batch variables? (y/n): ";
+	std::cin >> groupChoice;
+	options.groupByShape = (groupChoice == "y" || groupChoice == "Y");
+
+	std::string pyramidChoice;
+	std::cout << "Generate downsampled levels and thumbnails? (y/n): ";
+	std::cin >> pyramidChoice;
+	options.pyramid = (pyramidChoice == "y" || pyramidChoice == "Y");
+
+	std::string containerChoice;
+	std::cout << "Pack into a shared container instead of a file of its own? (y/n): ";
+	std::cin >> containerChoice;
+	const bool packed = (containerChoice == "y" || containerChoice == "Y");
+
+	// Every question is asked up front, so that nothing waits on the user once a container slot is reserved
+	if (fs::is_directory(rawImagesPath) && !fs::exists(rawImagesPath + "metadata.txt")) {
+		options.metadataChoice = chooseMetadata(options.customMetadata);
+	}
+
+	// A packed experiment is converted into a staging file without any lock, and only the copy into the container is done under it
+	int containerId = -1;
+	if (packed) {
+		if (!reserveContainerSlot(experimentName, containerId, options.variablePrefix)) {
+			std::cout << "Error!";
+			return;
+		}
+		options.containerPath = CONTAINER_DIRECTORY + "staging/" + experimentName + ".bp";
+		fs::create_directories(CONTAINER_DIRECTORY + "staging/");
+		fs::remove_all(options.containerPath);
+	}
+	
+	std::cout << "\n";
+	std::string outputPath;
+	std::string metadataContent;
+	
+
+	ConversionResult result = convert_images(experimentName, rawImagesPath, options);
+	outputPath = result.outputPath;
+	metadataContent = result.metadataContent;
+
+	// The container stays locked until the catalog row exists, so that compaction cannot drop the new experiment
+	int containerLock = -1;
+	if (packed && outputPath != "Error") {
+		containerLock = appendToContainer(containerId, options.containerPath, options.variablePrefix, outputPath);
+		if (containerLock < 0) {
+			outputPath = "Error";
+		}
+	}
+	if (packed) {
+		fs::remove_all(options.containerPath);
+	}
+
+	if(outputPath != "Error") {
+		std::cout << "\nBP File Location: " << outputPath;
+		insertDataToDatabase(authorName, experimentName, outputPath, metadataContent, options.variablePrefix, result.storageBytes);
+		insertImageHashes(experimentName, result.hashes);
+	}
+	else {
+		std::cout << "Error!";
+	}
+
+	if (containerLock >= 0) {
+		close(containerLock);
+	}
+}
+
+//*****************************************************************************************************************************************************************
+
+// Query Experiments
+
+// Columns returned when none are chosen; metadataContent can be large and is only returned when asked for
+const std::vector<std::string> CATALOG_DEFAULT_COLUMNS = {"author_name", "experiment_name", "created_at", "storage_bytes"};
+
+bool queryExperiments(bool jsonLines) {
+    sqlite3* db;
+    int exit = 0;
+    exit = sqlite3_open("data.db", &db);
+
+    if (exit) {
+        std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    if (!createExperimentTable(db)) {
+        sqlite3_close(db);
+        return false;
+    }
+
+    // Every prompt reads a whole line, and an empty line keeps the default
+    std::ostream& prompt = jsonLines ? std::cerr : std::cout;
+    CatalogQuery query;
+    std::string input;
+
+    prompt << "Author (blank for any): ";
+    std::getline(std::cin, query.author);
+
+    prompt << "Experiment name prefix (blank for any): ";
+    std::getline(std::cin, query.namePrefix);
+
+    prompt << "Created from date YYYY-MM-DD (blank for any): ";
+    std::getline(std::cin, query.createdFrom);
+
+    prompt << "Created to date YYYY-MM-DD (blank for any): ";
+    std::getline(std::cin, query.createdTo);
+
+    for (const std::string* date : {&query.createdFrom, &query.createdTo}) {
+        if (!date->empty() && !isCalendarDate(*date)) {
+            std::cerr << "Error: '" << *date << "' is not a date of the form YYYY-MM-DD." << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+    }
+
+    double megabytes;
+    prompt << "Minimum storage in MB (blank for any): ";
+    std::getline(std::cin, input);
+    if (std::istringstream(input) >> megabytes) {
+        query.minStorageBytes = megabytes * 1024 * 1024;
+    }
+
+    prompt << "Maximum storage in MB (blank for any): ";
+    std::getline(std::cin, input);
+    if (std::istringstream(input) >> megabytes) {
+        query.maxStorageBytes = megabytes * 1024 * 1024;
+    }
+
+    prompt << "Columns, comma separated (blank for author_name,experiment_name,created_at,storage_bytes): ";
+    std::getline(std::cin, input);
+    std::istringstream columnList(input);
+    std::string column;
+    while (std::getline(columnList, column, ',')) {
+        column.erase(0, column.find_first_not_of(" \t"));
+        column.erase(column.find_last_not_of(" \t") + 1);
+        if (!column.empty()) {
+            query.columns.push_back(column);
+        }
+    }
+
+    prompt << "Order by name, created, size or id, '-' in front for descending (blank for name): ";
+    std::getline(std::cin, input);
+    if (!input.empty() && input[0] == '-') {
+        query.descending = true;
+        input.erase(0, 1);
+    }
+    if (!input.empty()) {
+        query.orderBy = input;
+    }
+
+    size_t pageSize;
+    prompt << "Page size (blank for 20): ";
+    std::getline(std::cin, input);
+    if ((std::istringstream(input) >> pageSize) && pageSize > 0) {
+        query.pageSize = pageSize;
+    }
+
+    prompt << std::endl;
+
+    // JSON lines are meant for other programs, so they stream every page instead of asking for the next one
+    CatalogPage page;
+    while (queryCatalog(db, query, page)) {
+        printCatalogPage(page, jsonLines);
+
+        if (!page.hasMore) {
+            break;
+        }
+
+        if (!jsonLines) {
+            prompt << "Show next page? (y/n): ";
+            std::getline(std::cin, input);
+            if (input != "y" && input != "Y") {
+                break;
+            }
+        }
+
+        query.hasCursor = true;
+        query.cursorValue = page.nextValue;
+        query.cursorId = page.nextId;
+    }
+
+    sqlite3_close(db);
+
+    return true;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Query Catalog
+
+bool queryCatalog(sqlite3* db, const CatalogQuery& query, CatalogPage& page) {
+	// Column names are spliced into the SQL, so only known ones are accepted
+	const std::vector<std::string> knownColumns = {"id", "author_name", "experiment_name", "adios_image_path", "variable_prefix", "created_at", "storage_bytes", "metadataContent"};
+	const std::map<std::string, std::string> sortColumns = {{"name", "experiment_name"}, {"created", "created_at"}, {"size", "storage_bytes"}, {"id", "id"}};
+
+	page = CatalogPage();
+	page.columns = query.columns.empty() ? CATALOG_DEFAULT_COLUMNS : query.columns;
+
+	for (const auto& column : page.columns) {
+		if (std::find(knownColumns.begin(), knownColumns.end(), column) == knownColumns.end()) {
+			std::cerr << "Error: Unknown column '" << column << "'." << std::endl;
+			return false;
+		}
+	}
+
+	auto sort = sortColumns.find(query.orderBy);
+	if (sort == sortColumns.end()) {
+		std::cerr << "Error: Unknown order '" << query.orderBy << "'." << std::endl;
+		return false;
+	}
+	const std::string& sortColumn = sort->second;
+	const std::string direction = query.descending ? " DESC" : " ASC";
+
+	// The sort column and id always come last, they make up the cursor of the next page
+	std::string sql = "SELECT ";
+	for (const auto& column : page.columns) {
+		sql += column + ", ";
+	}
+	sql += sortColumn + ", id FROM experiment_data WHERE 1";
+
+	// Values to bind, in order, and whether each is an integer
+	std::vector<std::pair<std::string, bool>> values;
+
+	if (!query.author.empty()) {
+		sql += " AND author_name = ?";
+		values.push_back(std::make_pair(query.author, false));
+	}
+
+	if (!query.namePrefix.empty()) {
+		// A range rather than LIKE, so the UNIQUE index on the name is used; the upper bound is the prefix with its last byte incremented
+		sql += " AND experiment_name >= ?";
+		values.push_back(std::make_pair(query.namePrefix, false));
+
+		std::string upperBound = query.namePrefix;
+		while (!upperBound.empty() && static_cast<unsigned char>(upperBound.back()) == 0xFF) {
+			upperBound.pop_back();
+		}
+		if (!upperBound.empty()) {
+			upperBound.back() = upperBound.back() + 1;
+			sql += " AND experiment_name < ?";
+			values.push_back(std::make_pair(upperBound, false));
+		}
+	}
+
+	if (!query.createdFrom.empty()) {
+		sql += " AND created_at >= CAST(strftime('%s', ?) AS INTEGER)";
+		values.push_back(std::make_pair(query.createdFrom, false));
+	}
+
+	if (!query.createdTo.empty()) {
+		sql += " AND created_at < CAST(strftime('%s', ?, '+1 day') AS INTEGER)";
+		values.push_back(std::make_pair(query.createdTo, false));
+	}
+
+	if (query.minStorageBytes >= 0) {
+		sql += " AND storage_bytes >= ?";
+		values.push_back(std::make_pair(std::to_string(query.minStorageBytes), true));
+	}
+
+	if (query.maxStorageBytes >= 0) {
+		sql += " AND storage_bytes <= ?";
+		values.push_back(std::make_pair(std::to_string(query.maxStorageBytes), true));
+	}
+
+	if (query.hasCursor) {
+		// A row value comparison lets SQLite seek the (sort column, id) index straight to the next page
+		sql += " AND (" + sortColumn + ", id) " + (query.descending ? "<" : ">") + " (?, ?)";
+		values.push_back(std::make_pair(query.cursorValue, sortColumn != "experiment_name"));
+		values.push_back(std::make_pair(std::to_string(query.cursorId), true));
+	}
+
+	// One row beyond the page tells whether there is a next one
+	sql += " ORDER BY " + sortColumn + direction + ", id" + direction + " LIMIT ?;";
+	values.push_back(std::make_pair(std::to_string(query.pageSize + 1), true));
+
+	sqlite3_stmt* stmt;
+	int rc = sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (values[i].second && values[i].first.empty()) {
+			sqlite3_bind_null(stmt, i + 1);
+		} else if (values[i].second) {
+			sqlite3_bind_int64(stmt, i + 1, std::stoll(values[i].first));
+		} else {
+			sqlite3_bind_text(stmt, i + 1, values[i].first.c_str(), -1, SQLITE_TRANSIENT);
+		}
+	}
+
+	const int sortIndex = page.columns.size();
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (page.rows.size() == query.pageSize) {
+			page.hasMore = true;
+			break;
+		}
+
+		std::vector<std::string> row;
+		for (int i = 0; i < sortIndex; ++i) {
+			const unsigned char* text = sqlite3_column_text(stmt, i);
+			row.push_back(text ? reinterpret_cast<const char*>(text) : "");
+		}
+		page.rows.push_back(row);
+
+		const unsigned char* sortValue = sqlite3_column_text(stmt, sortIndex);
+		page.nextValue = sortValue ? reinterpret_cast<const char*>(sortValue) : "";
+		page.nextId = sqlite3_column_int64(stmt, sortIndex + 1);
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		std::cerr << "Error: Failed to execute query: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Print Catalog Page
+
+void printCatalogPage(const CatalogPage& page, bool jsonLines) {
+	const std::map<std::string, std::string> labels = {
+		{"id", "Id"}, {"author_name", "Author Name"}, {"experiment_name", "Experiment Name"}, {"adios_image_path", "Adios Image Path"},
+		{"variable_prefix", "Container Prefix"}, {"created_at", "Created"}, {"storage_bytes", "Storage Bytes"}, {"metadataContent", "MetaData"}};
+
+	for (const auto& row : page.rows) {
+		if (jsonLines) {
+			std::string line = "{";
+			for (size_t i = 0; i < page.columns.size(); ++i) {
+				const std::string& column = page.columns[i];
+				const bool isNumber = (column == "id" || column == "created_at" || column == "storage_bytes");
+				line += (i ? ", \"" : "\"") + column + "\": ";
+				line += isNumber ? (row[i].empty() ? "null" : row[i]) : "\"" + jsonEscape(row[i]) + "\"";
+			}
+			std::cout << line << "}\n";
+			continue;
+		}
+
+		for (size_t i = 0; i < page.columns.size(); ++i) {
+			const std::string& column = page.columns[i];
+			std::string value = row[i];
+
+			// Rows from before creation times were recorded hold 0
+			if (column == "created_at") {
+				std::time_t seconds = std::atoll(value.c_str());
+				char date[32] = "unknown";
+				if (seconds > 0) {
+					std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S UTC", std::gmtime(&seconds));
+				}
+				value = date;
+			}
+
+			std::cout << labels.at(column) << (column == "metadataContent" ? ": \n" : ": ") << value << std::endl;
+		}
+		std::cout << "-----------------------------" << std::endl;
+	}
+
+	std::cout.flush();
+}
+
+bool isCalendarDate(const std::string& date) {
+	if (date.size() != 10 || date[4] != '-' || date[7] != '-') {
+		return false;
+	}
+
+	for (size_t i : {0, 1, 2, 3, 5, 6, 8, 9}) {
+		if (date[i] < '0' || date[i] > '9') {
+			return false;
+		}
+	}
+
+	const int month = std::stoi(date.substr(5, 2));
+	const int day = std::stoi(date.substr(8, 2));
+	return month >= 1 && month <= 12 && day >= 1 && day <= 31;
+}
+
+std::string jsonEscape(const std::string& value) {
+	std::string escaped;
+	for (char c : value) {
+		switch (c) {
+		case '"': escaped += "\\\""; break;
+		case '\\': escaped += "\\\\"; break;
+		case '\n': escaped += "\\n"; break;
+		case '\r': escaped += "\\r"; break;
+		case '\t': escaped += "\\t"; break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char code[8];
+				std::snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			} else {
+				escaped += c;
+			}
+		}
+	}
+	return escaped;
+}
+
+//*****************************************************************************************************************************************************************
+
+// List Latest Experiments
+
+// Experiments listed before extract and delete ask for a name
+const size_t LATEST_EXPERIMENTS = 20;
+
+void listLatestExperiments() {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
+
+	if (!createExperimentTable(db)) {
+		sqlite3_close(db);
+		return;
+	}
+
+	CatalogQuery query;
+	query.columns = {"experiment_name", "author_name", "created_at"};
+	query.orderBy = "created";
+	query.descending = true;
+	query.pageSize = LATEST_EXPERIMENTS;
+
+	CatalogPage page;
+	if (queryCatalog(db, query, page)) {
+		printCatalogPage(page, false);
+		if (page.hasMore) {
+			std::cout << "Only the latest " << LATEST_EXPERIMENTS << " experiments are listed, use Query Data (2) to search the rest." << std::endl;
+		}
+	}
+
+	sqlite3_close(db);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Extract Images from Folder
+
+// Number of frames read per selection when extracting a group variable
+const size_t GROUP_READ_BATCH = 64;
+
+void extractImages() {
+    sqlite3* db;
+    int exit = 0;
+    exit = sqlite3_open("data.db", &db);
+	
+    if (exit) {
+        std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+        return;
+    }
+
+    listLatestExperiments();
+
+    std::string experimentName;
+    std::cout << "Enter Experiment Name to Extract Images: ";
+    std::cin >> experimentName;
+
+    int level = 0;
+    std::cout << "Enter resolution level (0 for full resolution, k for 1/2^k, -1 for thumbnails): ";
+    std::cin >> level;
+    
+    std::string query = "SELECT adios_image_path, variable_prefix, id FROM experiment_data WHERE experiment_name = ?;";
+    sqlite3_stmt* stmt;
+    int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+
+    if (rc != SQLITE_OK) {
+        std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        return;
+    }
+
+    rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+
+    if (rc != SQLITE_OK) {
+        std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return;
+    }
+
+    rc = sqlite3_step(stmt);
+
+    if (rc != SQLITE_ROW) {
+        std::cerr << "Error: Experiment not found in the database." << std::endl;
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return;
+    }
+
+    std::string adiosImagePath(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+    std::string prefix(sqlite3_column_text(stmt, 1) ? reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)) : "");
+    const std::string cacheIdentity = experimentCacheIdentity(sqlite3_column_int64(stmt, 2));
+    std::cout << "BP File Path: " << adiosImagePath << "\n\n";
+	
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    adios2::ADIOS adios;
+    adios2::IO bpIO = adios.DeclareIO("image_read");
+    adios2::Engine bpReader = bpIO.Open(adiosImagePath, adios2::Mode::Read);
+
+
+    // Names are relative to the experiment's prefix from here on, ADIOS calls put it back
+    const std::map<std::string, adios2::Params> varss = experimentVariables(bpIO, prefix);
+    std::string output_folder = "/home/pbhatia4/Desktop/Adios2C-Implementation/Data-Output/" + experimentName + "/";
+    fs::create_directories(output_folder);
+
+    if (level != 0) {
+        extractLevel(bpIO, bpReader, varss, prefix, cacheIdentity, output_folder, level);
+    }
+
+    for (const auto& variable_name : varss) {
+        // Full resolution images are only written when level 0 was requested
+        if (level != 0 || isDerivedVariable(variable_name.first)) {
+            continue;
+        }
+
+        const std::string variableName = prefix + variable_name.first;
+        int depth;
+        adios2::Dims shape;
+        if (!inquireImageVariable(bpIO, variableName, depth, shape)) {
+            continue;
+        }
+
+        if (shape.size() == 4) {
+            // Group variables are read a batch of frames at a time, each batch being one contiguous selection
+            const size_t frameSize = shape[1] * shape[2] * shape[3] * CV_ELEM_SIZE1(depth);
+
+            std::vector<std::string> names;
+            auto namesAttribute = bpIO.InquireAttribute<std::string>(variableName + "/names");
+            if (namesAttribute) {
+                names = namesAttribute.Data();
+            }
+
+            SharedImageCache& cache = SharedImageCache::instance();
+            std::vector<uint8_t> batch;
+            for (size_t first = 0; first < shape[0]; first += GROUP_READ_BATCH) {
+                const size_t count = std::min(GROUP_READ_BATCH, shape[0] - first);
+                batch.resize(count * frameSize);
+
+                // The batch is only read from ADIOS when the cache misses some of its frames, which are then cached
+                std::vector<size_t> missing;
+                for (size_t k = 0; k < count; ++k) {
+                    if (!cache.enabled() || !cache.get(imageCacheKey(cacheIdentity, variableName, {first + k, 0, 0, 0}), batch.data() + k * frameSize, frameSize)) {
+                        missing.push_back(k);
+                    }
+                }
+
+                if (!missing.empty()) {
+                    getImageData(bpIO, bpReader, variableName, depth, {first, 0, 0, 0}, {count, shape[1], shape[2], shape[3]}, batch.data());
+                    for (size_t k : missing) {
+                        if (cache.enabled()) {
+                            cache.put(imageCacheKey(cacheIdentity, variableName, {first + k, 0, 0, 0}), batch.data() + k * frameSize, frameSize);
+                        }
+                    }
+                }
+
+                for (size_t k = 0; k < count; ++k) {
+                    if (first + k >= names.size() || names[first + k].empty()) {
+                        continue;
+                    }
+                    std::cout << "Reading " << names[first + k] << " from " << variable_name.first << std::endl;
+                    cv::Mat image(shape[1], shape[2], CV_MAKETYPE(depth, shape[3]), batch.data() + k * frameSize);
+                    cv::imwrite(output_folder + names[first + k], image);
+                }
+            }
+        } else if (shape.size() == 3) {
+            std::cout << "Reading " << variable_name.first << std::endl;
+            size_t height = shape[0];
+            size_t width = shape[1];
+            size_t channels = shape[2];
+
+            // The Mat is created with the stored element type and channel count, so the image is written back as it was read
+            cv::Mat image(height, width, CV_MAKETYPE(depth, channels));
+            readImageCached(bpIO, bpReader, cacheIdentity, variableName, depth, {0, 0, 0}, {height, width, channels}, image.data);
+            cv::imwrite(output_folder + variable_name.first, image);
+        }
+    }
+
+	adios2::Attribute<std::string> metadataAttribute;
+
+	// Inquire the attribute from the BP file
+	metadataAttribute = bpIO.InquireAttribute<std::string>(prefix + "metadata");
+
+	// Check if the attribute exists
+	if (metadataAttribute) {
+	    // Retrieve the data associated with the attribute
+	    const std::vector<std::string>& metadataValues = metadataAttribute.Data();
+
+	    // Process the retrieved data as needed
+	    if (!metadataValues.empty()) {
+		std::string metadataValue = metadataValues[0];
+		std::cout << "\nInquired Attribute Value: \n" << metadataValue << std::endl;
+		std::ofstream metadataFile(output_folder + "metadata.txt");
+		metadataFile << metadataValue;
+		metadataFile.close();
+		std::cout << "Metadata Extracted at: " << output_folder << "metadata.txt";
+	    }
+	} else {
+		std::cerr << "Error: Attribute 'metadata' not found." << std::endl;
+	}
+
+    bpReader.Close();
+    
+    std::cout << "\nImages Recreated at: " << output_folder << std::endl;
+
+}
+
+//*****************************************************************************************************************************************************************
+
+// Extract Level
+
+void extractLevel(adios2::IO& bpIO, adios2::Engine& bpReader, const std::map<std::string, adios2::Params>& variables, const std::string& prefix, const std::string& cacheIdentity, const std::string& outputFolder, int level) {
+	const std::string levelFolder = outputFolder + (level < 0 ? "thumbnails/" : "L" + std::to_string(level) + "/");
+	fs::create_directories(levelFolder);
+
+	// Every image of a pyramid-enabled experiment has a thumbnail, which makes it the list of images to visit
+	const std::string thumbnailPrefix = "thumbnail/";
+	size_t extracted = 0;
+
+	for (const auto& variable : variables) {
+		if (variable.first.compare(0, thumbnailPrefix.size(), thumbnailPrefix) != 0) {
+			continue;
+		}
+
+		const std::string fileName = variable.first.substr(thumbnailPrefix.size());
+		const std::string variableName = prefix + levelVariableName(variables, fileName, level);
+
+		int depth;
+		adios2::Dims shape;
+		if (!inquireImageVariable(bpIO, variableName, depth, shape) || shape.size() != 3) {
+			continue;
+		}
+
+		std::cout << "Reading " << variableName << std::endl;
+		cv::Mat image(shape[0], shape[1], CV_MAKETYPE(depth, shape[2]));
+		readImageCached(bpIO, bpReader, cacheIdentity, variableName, depth, {0, 0, 0}, {shape[0], shape[1], shape[2]}, image.data);
+		cv::imwrite(levelFolder + fileName, image);
+		++extracted;
+	}
+
+	if (extracted == 0) {
+		std::cerr << "Error: No downsampled levels stored for this experiment." << std::endl;
+	}
+}
+
+//*****************************************************************************************************************************************************************
+
+// Delete Experiment
+
+void deleteExperiment() {
+	sqlite3* db;
+	int exit = 0;
+	exit = sqlite3_open("data.db", &db);
+
+	if (exit) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
+
+	listLatestExperiments();
+
+	std::string experimentName;
+	std::cout << "Enter Experiment Name to Delete: ";
+	std::cin >> experimentName;
+
+
+	if (!checkdb(experimentName)) {
+		std::cout << "Experiment Does Not Exist!" << std::endl;		
+		return;
+	}
+
+	std::string adiosImagePath;
+	std::string variablePrefix;
+	long experimentId;
+	if (!getExperimentLocation(experimentName, adiosImagePath, variablePrefix, experimentId)) {
+		sqlite3_close(db);
+		return;
+	}
+
+	// A packed experiment is deleted under its container's lock, so a compaction either copies it with its row or drops it with its tombstone.
+	// The location is read again under the lock, since a compaction that held it may have moved the experiment to a new generation.
+	int containerLock = -1;
+	if (!variablePrefix.empty()) {
+		sqlite3_busy_timeout(db, 5000);
+		containerLock = lockContainerAt(db, adiosImagePath);
+		if (containerLock < 0 || !getExperimentLocation(experimentName, adiosImagePath, variablePrefix, experimentId)) {
+			if (containerLock >= 0) {
+				close(containerLock);
+			}
+			sqlite3_close(db);
+			return;
+		}
+	}
+
+	// The row and the tombstone of a packed experiment are written together, so compaction never sees one without the other.
+	// Closing the connection without a COMMIT rolls back a partial delete.
+	const bool deleted = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr) == SQLITE_OK
+		&& runStatement(db, "DELETE FROM experiment_data WHERE experiment_name = ?;", {experimentName})
+		&& (variablePrefix.empty() || runStatement(db, "INSERT INTO container_tombstones (container_path, variable_prefix) VALUES (?, ?);", {adiosImagePath, variablePrefix}))
+		&& sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
+
+	if (containerLock >= 0) {
+		close(containerLock);
+	}
+
+	if (!deleted) {
+		std::cerr << "Error: Failed to delete " << experimentName << ": " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		return;
+	}
+
+	// Drop the experiment's images from the similarity index
+	if (createHashTable(db)) {
+		std::string deleteHashesQuery = "DELETE FROM image_hashes WHERE experiment_name = ?;";
+		sqlite3_stmt* stmt;
+		int rc = sqlite3_prepare_v2(db, deleteHashesQuery.c_str(), -1, &stmt, nullptr);
+
+		if (rc == SQLITE_OK) {
+			sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+			if (sqlite3_step(stmt) != SQLITE_DONE) {
+				std::cerr << "Error: Failed to delete image hashes: " << sqlite3_errmsg(db) << std::endl;
+			}
+			sqlite3_finalize(stmt);
+		} else {
+			std::cerr << "Error: Failed to prepare delete query: " << sqlite3_errmsg(db) << std::endl;
+		}
+	}
+
+	sqlite3_close(db);
+
+	if (!variablePrefix.empty()) {
+		// Other experiments share the container, its space is reclaimed by the next compaction
+		std::cout << "Experiment tombstoned in " << adiosImagePath << ", run compaction (8) to reclaim its space" << std::endl;
+	} else {
+		// Remove the directory containing the images.bp file
+		std::string outputPath = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/" + experimentName;
+		fs::remove_all(outputPath);
+	}
+
+	std::cout << "Experiment '" << experimentName << "' Deleted Successfully!" << std::endl;		
+		
+}
+
+//*****************************************************************************************************************************************************************
+
+// Buffer Pool
+
+BufferPool::State::~State() {
+	for (auto buffer : available) {
+		delete buffer;
+	}
+}
+
+std::shared_ptr<std::vector<uint8_t>> BufferPool::acquire(size_t bytes) {
+	std::vector<uint8_t>* buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(state->mutex);
+		if (!state->available.empty()) {
+			buffer = state->available.back();
+			state->available.pop_back();
+		}
+	}
+
+	if (buffer == nullptr) {
+		buffer = new std::vector<uint8_t>();
+	}
+
+	// Recycled buffers keep their capacity, so this only allocates when a larger image comes along
+	buffer->resize(bytes);
+
+	std::shared_ptr<State> owner = state;
+	return std::shared_ptr<std::vector<uint8_t>>(buffer, [owner](std::vector<uint8_t>* released) {
+		std::lock_guard<std::mutex> lock(owner->mutex);
+		owner->available.push_back(released);
+	});
+}
+
+//*****************************************************************************************************************************************************************
+
+// Shared Image Cache
+
+const char* const SHARED_CACHE_NAME = "/adios2c_image_cache";
+const size_t SHARED_CACHE_SLOTS = 4096;            // Images the index can hold, whatever their size
+const size_t SHARED_CACHE_BUCKETS = 8192;          // Hash index buckets, twice the slots so chains stay short
+const size_t SHARED_CACHE_KEY_LENGTH = 240;        // Longer keys are not cached
+const int32_t SHARED_CACHE_NONE = -1;              // Null slot index in chains and lists
+const size_t SHARED_CACHE_PINNERS = 8;             // Readers copying one image at a time, further ones read from the BP file instead
+const uint64_t SHARED_CACHE_RECLAIM_INTERVAL = 4096; // Lock acquisitions between scans for slots held by dead processes
+const uint64_t SHARED_CACHE_MAGIC = 0x494d474341434833ULL;
+
+enum SharedCacheSlotState : uint32_t {
+	SLOT_FREE,      // On the free list
+	SLOT_FILLING,   // Extent reserved by put, not yet in the index
+	SLOT_LIVE,      // In the index and the LRU list
+	SLOT_EVICTED    // Out of the index, its extent is released by the last reader unpinning it
+};
+
+struct SharedImageCache::Slot {
+	uint64_t hash;
+	uint64_t offset;     // Into the data area following the header
+	uint64_t bytes;
+	uint32_t state;
+	uint32_t pins;       // Readers copying out of the extent outside the lock
+	int32_t chain;       // Next slot in the same bucket, or on the free list
+	int32_t newer;       // LRU neighbours
+	int32_t older;
+	int32_t filler;      // Process copying into a SLOT_FILLING extent
+	int32_t pinners[SHARED_CACHE_PINNERS];   // Process of each pin, 0 for an unused entry
+	char key[SHARED_CACHE_KEY_LENGTH];
+};
+
+struct SharedImageCache::Extent {
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+// Lives at the start of the segment. Keys are found through the bucket chains, free space through the extent list,
+// which is sorted by offset and coalesced, so no operation scans every slot.
+struct SharedImageCache::Header {
+	std::atomic<uint64_t> ready;   // SHARED_CACHE_MAGIC once the creating process has initialised the segment
+	pthread_mutex_t mutex;
+	uint64_t capacity;
+	uint64_t used;                 // Bytes of reserved extents, including those still being filled or read
+	uint64_t entries;
+	uint64_t epoch;                // Bumped by reset, so copies made outside the lock across one are discarded
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t insertions;
+	uint64_t locks;                // Acquisitions since the last scan for dead processes
+	int32_t freeSlots;
+	int32_t newest;
+	int32_t oldest;
+	uint32_t extentCount;
+	int32_t buckets[SHARED_CACHE_BUCKETS];
+	Slot slots[SHARED_CACHE_SLOTS];
+	Extent extents[SHARED_CACHE_SLOTS + 1];   // Free space; the gaps between reserved extents are at most one more than the slots
+};
+
+SharedImageCache& SharedImageCache::instance() {
+	static SharedImageCache cache;
+	return cache;
+}
+
+bool SharedImageCache::remove() {
+	return shm_unlink(SHARED_CACHE_NAME) == 0;
+}
+
+SharedImageCache::SharedImageCache() {
+	const char* sizeSetting = std::getenv("IMAGE_CACHE_MB");
+	const uint64_t capacity = sizeSetting ? std::strtoull(sizeSetting, nullptr, 10) * 1024 * 1024 : 0;
+
+	if (capacity == 0) {
+		return;
+	}
+
+	// Exactly one process creates and initialises the segment, the others attach to it
+	bool created = true;
+	int descriptor = shm_open(SHARED_CACHE_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (descriptor < 0 && errno == EEXIST) {
+		created = false;
+		descriptor = shm_open(SHARED_CACHE_NAME, O_RDWR, 0600);
+	}
+
+	if (descriptor < 0) {
+		std::cerr << "Error: Can't open shared image cache: " << std::strerror(errno) << std::endl;
+		return;
+	}
+
+	size_t segmentBytes = sizeof(Header) + capacity;
+	if (created) {
+		if (ftruncate(descriptor, segmentBytes) != 0) {
+			std::cerr << "Error: Can't size shared image cache: " << std::strerror(errno) << std::endl;
+			close(descriptor);
+			remove();
+			return;
+		}
+	} else {
+		// The creating process may not have sized the segment yet
+		struct stat status;
+		status.st_size = 0;
+		for (int attempt = 0; attempt < 100 && size_t(status.st_size) <= sizeof(Header); ++attempt) {
+			if (fstat(descriptor, &status) != 0 || size_t(status.st_size) <= sizeof(Header)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+		}
+		segmentBytes = status.st_size;
+	}
+
+	void* memory = (segmentBytes > sizeof(Header)) ? mmap(nullptr, segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+	close(descriptor);
+
+	if (memory == MAP_FAILED) {
+		std::cerr << "Error: Can't map shared image cache, remove it with flag 10" << std::endl;
+		return;
+	}
+
+	Header* mapped = static_cast<Header*>(memory);
+
+	if (created) {
+		pthread_mutexattr_t attributes;
+		pthread_mutexattr_init(&attributes);
+		pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+		// A process killed while holding the lock must not wedge every other one
+		pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&mapped->mutex, &attributes);
+		pthread_mutexattr_destroy(&attributes);
+
+		// Counters start out zero, as ftruncate left them; the index and free lists are built by reset
+		mapped->capacity = capacity;
+		header = mapped;
+		reset();
+		mapped->ready.store(SHARED_CACHE_MAGIC);
+	} else {
+		for (int attempt = 0; attempt < 100 && mapped->ready.load() != SHARED_CACHE_MAGIC; ++attempt) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+
+		// A segment of an older layout carries another magic and is not used
+		if (mapped->ready.load() != SHARED_CACHE_MAGIC || sizeof(Header) + mapped->capacity > segmentBytes) {
+			std::cerr << "Error: Shared image cache was not initialised, remove it with flag 10" << std::endl;
+			munmap(memory, segmentBytes);
+			return;
+		}
+
+		if (mapped->capacity != capacity) {
+			std::cout << "Shared image cache was created with " << mapped->capacity / (1024 * 1024) << " MB, remove it with flag 10 to apply IMAGE_CACHE_MB" << std::endl;
+		}
+	}
+
+	header = mapped;
+	data = static_cast<uint8_t*>(memory) + sizeof(Header);
+	mappedBytes = segmentBytes;
+}
+
+SharedImageCache::~SharedImageCache() {
+	if (header) {
+		munmap(header, mappedBytes);
+	}
+}
+
+bool SharedImageCache::enabled() const {
+	return header != nullptr;
+}
+
+uint64_t SharedImageCache::hashKey(const std::string& key) {
+	// FNV-1a, identical in every process unlike std::hash
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : key) {
+		hash = (hash ^ c) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool SharedImageCache::lock() {
+	int rc = pthread_mutex_lock(&header->mutex);
+
+	if (rc == EOWNERDEAD) {
+		// The previous owner died mid-update, so the index can no longer be trusted
+		reset();
+		pthread_mutex_consistent(&header->mutex);
+		return true;
+	}
+
+	// A process killed while copying outside the lock leaves its pins and fills behind, they are collected now and then
+	if (rc == 0 && ++header->locks >= SHARED_CACHE_RECLAIM_INTERVAL) {
+		reclaim();
+	}
+	return rc == 0;
+}
+
+void SharedImageCache::unlock() {
+	pthread_mutex_unlock(&header->mutex);
+}
+
+void SharedImageCache::reset() {
+	for (auto& bucket : header->buckets) {
+		bucket = SHARED_CACHE_NONE;
+	}
+
+	for (size_t i = 0; i < SHARED_CACHE_SLOTS; ++i) {
+		header->slots[i].state = SLOT_FREE;
+		header->slots[i].pins = 0;
+		std::fill(header->slots[i].pinners, header->slots[i].pinners + SHARED_CACHE_PINNERS, 0);
+		header->slots[i].chain = (i + 1 < SHARED_CACHE_SLOTS) ? int32_t(i + 1) : SHARED_CACHE_NONE;
+	}
+
+	header->freeSlots = 0;
+	header->newest = SHARED_CACHE_NONE;
+	header->oldest = SHARED_CACHE_NONE;
+	header->extents[0].offset = 0;
+	header->extents[0].bytes = header->capacity;
+	header->extentCount = 1;
+	header->used = 0;
+	header->entries = 0;
+	++header->epoch;
+}
+
+int32_t SharedImageCache::find(const std::string& key, uint64_t hash) {
+	for (int32_t i = header->buckets[hash % SHARED_CACHE_BUCKETS]; i != SHARED_CACHE_NONE; i = header->slots[i].chain) {
+		if (header->slots[i].hash == hash && key == header->slots[i].key) {
+			return i;
+		}
+	}
+	return SHARED_CACHE_NONE;
+}
+
+void SharedImageCache::link(int32_t index) {
+	Slot& slot = header->slots[index];
+	int32_t& bucket = header->buckets[slot.hash % SHARED_CACHE_BUCKETS];
+	slot.chain = bucket;
+	bucket = index;
+
+	slot.newer = SHARED_CACHE_NONE;
+	slot.older = header->newest;
+	if (header->newest != SHARED_CACHE_NONE) {
+		header->slots[header->newest].newer = index;
+	}
+	header->newest = index;
+	if (header->oldest == SHARED_CACHE_NONE) {
+		header->oldest = index;
+	}
+}
+
+void SharedImageCache::unlink(int32_t index) {
+	Slot& slot = header->slots[index];
+	int32_t* link = &header->buckets[slot.hash % SHARED_CACHE_BUCKETS];
+	while (*link != index) {
+		link = &header->slots[*link].chain;
+	}
+	*link = slot.chain;
+
+	(slot.newer != SHARED_CACHE_NONE ? header->slots[slot.newer].older : header->newest) = slot.older;
+	(slot.older != SHARED_CACHE_NONE ? header->slots[slot.older].newer : header->oldest) = slot.newer;
+}
+
+void SharedImageCache::release(int32_t index) {
+	Slot& slot = header->slots[index];
+
+	// The extent goes back into the offset-sorted free list, merged with the free neighbours it touches
+	Extent* extents = header->extents;
+	uint32_t position = std::lower_bound(extents, extents + header->extentCount, slot.offset,
+		[](const Extent& extent, uint64_t offset) { return extent.offset < offset; }) - extents;
+
+	const bool mergesBefore = position > 0 && extents[position - 1].offset + extents[position - 1].bytes == slot.offset;
+	const bool mergesAfter = position < header->extentCount && slot.offset + slot.bytes == extents[position].offset;
+
+	if (mergesBefore && mergesAfter) {
+		extents[position - 1].bytes += slot.bytes + extents[position].bytes;
+		std::memmove(extents + position, extents + position + 1, (header->extentCount - position - 1) * sizeof(Extent));
+		--header->extentCount;
+	} else if (mergesBefore) {
+		extents[position - 1].bytes += slot.bytes;
+	} else if (mergesAfter) {
+		extents[position].offset = slot.offset;
+		extents[position].bytes += slot.bytes;
+	} else {
+		std::memmove(extents + position + 1, extents + position, (header->extentCount - position) * sizeof(Extent));
+		extents[position].offset = slot.offset;
+		extents[position].bytes = slot.bytes;
+		++header->extentCount;
+	}
+
+	header->used -= slot.bytes;
+	slot.state = SLOT_FREE;
+	slot.chain = header->freeSlots;
+	header->freeSlots = index;
+}
+
+void SharedImageCache::evict(int32_t index) {
+	Slot& slot = header->slots[index];
+	unlink(index);
+	--header->entries;
+	++header->evictions;
+
+	// A pinned extent is still being copied out, the last reader releases it
+	if (slot.pins > 0) {
+		slot.state = SLOT_EVICTED;
+	} else {
+		release(index);
+	}
+}
+
+void SharedImageCache::reclaim() {
+	header->locks = 0;
+
+	// Only ESRCH means the process is gone; a recycled pid keeps its slot until the next scan after it exits
+	auto dead = [](int32_t pid) { return kill(pid, 0) != 0 && errno == ESRCH; };
+
+	for (size_t i = 0; i < SHARED_CACHE_SLOTS; ++i) {
+		Slot& slot = header->slots[i];
+
+		if (slot.state == SLOT_FILLING && dead(slot.filler)) {
+			release(i);
+			continue;
+		}
+
+		if (slot.pins == 0) {
+			continue;
+		}
+
+		for (int32_t& pinner : slot.pinners) {
+			if (pinner != 0 && dead(pinner)) {
+				pinner = 0;
+				--slot.pins;
+			}
+		}
+
+		if (slot.pins == 0 && slot.state == SLOT_EVICTED) {
+			release(i);
+		}
+	}
+}
+
+int32_t SharedImageCache::allocate(size_t bytes) {
+	bool reclaimed = false;
+
+	while (true) {
+		if (header->freeSlots != SHARED_CACHE_NONE) {
+			// First fit in address order
+			Extent* extents = header->extents;
+			for (uint32_t e = 0; e < header->extentCount; ++e) {
+				if (extents[e].bytes < bytes) {
+					continue;
+				}
+
+				const int32_t index = header->freeSlots;
+				Slot& slot = header->slots[index];
+				header->freeSlots = slot.chain;
+				slot.offset = extents[e].offset;
+				slot.bytes = bytes;
+				slot.pins = 0;
+				std::fill(slot.pinners, slot.pinners + SHARED_CACHE_PINNERS, 0);
+
+				extents[e].offset += bytes;
+				extents[e].bytes -= bytes;
+				if (extents[e].bytes == 0) {
+					std::memmove(extents + e, extents + e + 1, (header->extentCount - e - 1) * sizeof(Extent));
+					--header->extentCount;
+				}
+
+				header->used += bytes;
+				return index;
+			}
+		}
+
+		// Nothing left to evict, but extents may still be held by pins and fills of dead processes
+		if (header->oldest == SHARED_CACHE_NONE) {
+			if (reclaimed) {
+				return SHARED_CACHE_NONE;
+			}
+			reclaim();
+			reclaimed = true;
+			continue;
+		}
+		evict(header->oldest);
+	}
+}
+
+bool SharedImageCache::get(const std::string& key, void* out, size_t bytes) {
+	if (!header || key.size() >= SHARED_CACHE_KEY_LENGTH || !lock()) {
+		return false;
+	}
+
+	const uint64_t epoch = header->epoch;
+	const int32_t index = find(key, hashKey(key));
+	if (index == SHARED_CACHE_NONE || header->slots[index].bytes != bytes) {
+		++header->misses;
+		unlock();
+		return false;
+	}
+
+	// Pinned under this process's id and moved to the front of the LRU list, then copied without holding the lock
+	Slot& slot = header->slots[index];
+	const int32_t pid = getpid();
+	int32_t* pinner = std::find(slot.pinners, slot.pinners + SHARED_CACHE_PINNERS, 0);
+	if (pinner == slot.pinners + SHARED_CACHE_PINNERS) {
+		++header->misses;
+		unlock();
+		return false;
+	}
+	*pinner = pid;
+	++slot.pins;
+	unlink(index);
+	link(index);
+	const uint64_t offset = slot.offset;
+	unlock();
+
+	std::memcpy(out, data + offset, bytes);
+
+	if (!lock()) {
+		return false;
+	}
+
+	// A reset in the meantime may have handed the extent to another image, so the copy is only trusted within one epoch
+	const bool hit = (header->epoch == epoch);
+	if (hit) {
+		++header->hits;
+		*std::find(slot.pinners, slot.pinners + SHARED_CACHE_PINNERS, pid) = 0;
+		if (--slot.pins == 0 && slot.state == SLOT_EVICTED) {
+			release(index);
+		}
+	} else {
+		++header->misses;
+	}
+
+	unlock();
+	return hit;
+}
+
+void SharedImageCache::put(const std::string& key, const void* in, size_t bytes) {
+	// One image may take at most a quarter of the cache, so a single huge one cannot evict everything else
+	if (!header || key.size() >= SHARED_CACHE_KEY_LENGTH || bytes == 0 || bytes > header->capacity / 4 || !lock()) {
+		return;
+	}
+
+	const uint64_t hash = hashKey(key);
+	const uint64_t epoch = header->epoch;
+	int32_t index = SHARED_CACHE_NONE;
+	if (find(key, hash) == SHARED_CACHE_NONE) {
+		index = allocate(bytes);
+	}
+
+	if (index == SHARED_CACHE_NONE) {
+		unlock();
+		return;
+	}
+
+	// The reserved extent is filled without holding the lock and only published in the index afterwards
+	Slot& slot = header->slots[index];
+	slot.state = SLOT_FILLING;
+	slot.filler = getpid();
+	slot.hash = hash;
+	std::strcpy(slot.key, key.c_str());
+	const uint64_t offset = slot.offset;
+	unlock();
+
+	std::memcpy(data + offset, in, bytes);
+
+	if (!lock()) {
+		return;
+	}
+
+	if (header->epoch == epoch) {
+		// Another process may have cached the same image while this one was copying
+		if (find(key, hash) == SHARED_CACHE_NONE) {
+			slot.state = SLOT_LIVE;
+			link(index);
+			++header->entries;
+			++header->insertions;
+		} else {
+			release(index);
+		}
+	}
+
+	unlock();
+}
+
+CacheStatistics SharedImageCache::statistics() {
+	CacheStatistics statistics = {};
+	if (!header || !lock()) {
+		return statistics;
+	}
+
+	statistics.capacity = header->capacity;
+	statistics.used = header->used;
+	statistics.entries = header->entries;
+	statistics.hits = header->hits;
+	statistics.misses = header->misses;
+	statistics.evictions = header->evictions;
+	statistics.insertions = header->insertions;
+
+	unlock();
+	return statistics;
+}
+
+void SharedImageCache::clear() {
+	if (!header || !lock()) {
+		return;
+	}
+	reset();
+	unlock();
+}
+
+std::string imageCacheKey(const std::string& cacheIdentity, const std::string& variableName, const adios2::Dims& start) {
+	std::string key = cacheIdentity + ":" + variableName;
+	for (size_t offset : start) {
+		key += "," + std::to_string(offset);
+	}
+	return key;
+}
+
+bool readImageCached(adios2::IO& bpIO, adios2::Engine& bpReader, const std::string& cacheIdentity, const std::string& variableName, int depth, const adios2::Dims& start, const adios2::Dims& count, void* data) {
+	SharedImageCache& cache = SharedImageCache::instance();
+	if (!cache.enabled() || cacheIdentity.empty()) {
+		return getImageData(bpIO, bpReader, variableName, depth, start, count, data);
+	}
+
+	size_t bytes = CV_ELEM_SIZE1(depth);
+	for (size_t extent : count) {
+		bytes *= extent;
+	}
+
+	const std::string key = imageCacheKey(cacheIdentity, variableName, start);
+	if (cache.get(key, data, bytes)) {
+		return true;
+	}
+
+	if (!getImageData(bpIO, bpReader, variableName, depth, start, count, data)) {
+		return false;
+	}
+
+	cache.put(key, data, bytes);
+	return true;
+}
+
+std::string experimentCacheIdentity(long experimentId) {
+	// Catalog ids are never reused (AUTOINCREMENT) and survive compaction, unlike paths and modification times
+	return "experiment/" + std::to_string(experimentId);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Image Dataset
+
+ImageDataset::ImageDataset(const std::string& bpPath, size_t prefetchDepth, size_t workerCount, int level, const std::string& prefix, const std::string& cacheIdentity)
+	: bpPath(bpPath), cacheIdentity(cacheIdentity), prefetchDepth(std::max<size_t>(prefetchDepth, 1)), workerCount(std::max<size_t>(workerCount, 1)) {
+	bpIO = adios.DeclareIO("dataset_read");
+	bpReader = bpIO.Open(bpPath, adios2::Mode::Read);
+
+	// Index every image variable once so that lookups by position need no metadata traffic
+	const std::map<std::string, adios2::Params> variables = experimentVariables(bpIO, prefix);
+	for (const auto& variable : variables) {
+		if (level != 0) {
+			// Downsampled levels are indexed through the thumbnails, which every image of a pyramid-enabled experiment has
+			const std::string thumbnailPrefix = "thumbnail/";
+			if (variable.first.compare(0, thumbnailPrefix.size(), thumbnailPrefix) != 0) {
+				continue;
+			}
+
+			const std::string fileName = variable.first.substr(thumbnailPrefix.size());
+			const std::string variableName = prefix + levelVariableName(variables, fileName, level);
+
+			int depth;
+			adios2::Dims shape;
+			if (inquireImageVariable(bpIO, variableName, depth, shape) && shape.size() == 3) {
+				entries.push_back({fileName, variableName, -1, shape[0], shape[1], shape[2], depth});
+			}
+			continue;
+		}
+
+		const std::string variableName = prefix + variable.first;
+		int depth;
+		adios2::Dims shape;
+		if (isDerivedVariable(variable.first) || !inquireImageVariable(bpIO, variableName, depth, shape)) {
+			continue;
+		}
+
+		if (shape.size() == 3) {
+			entries.push_back({variable.first, variableName, -1, shape[0], shape[1], shape[2], depth});
+		} else if (shape.size() == 4) {
+			auto namesAttribute = bpIO.InquireAttribute<std::string>(variableName + "/names");
+			if (!namesAttribute) {
+				continue;
+			}
+
+			const std::vector<std::string> names = namesAttribute.Data();
+			for (size_t slot = 0; slot < names.size(); ++slot) {
+				if (!names[slot].empty()) {
+					entries.push_back({names[slot], variableName, long(slot), shape[1], shape[2], shape[3], depth});
+				}
+			}
+		}
+	}
+
+	// Order by file name regardless of whether an image lives in a group
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.name < b.name; });
+}
+
+ImageDataset::~ImageDataset() {
+	bpReader.Close();
+}
+
+size_t ImageDataset::size() const {
+	return entries.size();
+}
+
+const std::string& ImageDataset::name(size_t i) const {
+	return entries.at(i).name;
+}
+
+cv::Size ImageDataset::imageSize(size_t i) const {
+	return cv::Size(entries.at(i).width, entries.at(i).height);
+}
+
+DatasetImage ImageDataset::operator[](size_t i) {
+	std::lock_guard<std::mutex> lock(readerMutex);
+	return read(bpIO, bpReader, i, cv::Rect(0, 0, entries.at(i).width, entries.at(i).height));
+}
+
+DatasetImage ImageDataset::region(size_t i, const cv::Rect& region) {
+	std::lock_guard<std::mutex> lock(readerMutex);
+	return read(bpIO, bpReader, i, region & cv::Rect(0, 0, entries.at(i).width, entries.at(i).height));
+}
+
+std::unique_ptr<ImageDataset::Epoch> ImageDataset::epoch(bool shuffle, unsigned seed) {
+	std::vector<size_t> order(entries.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+
+	if (shuffle) {
+		std::mt19937 generator(seed);
+		std::shuffle(order.begin(), order.end(), generator);
+	}
+
+	return std::unique_ptr<Epoch>(new Epoch(*this, order));
+}
+
+DatasetImage ImageDataset::read(adios2::IO& io, adios2::Engine& engine, size_t i, const cv::Rect& region) {
+	const Entry& entry = entries.at(i);
+
+	DatasetImage result;
+	result.name = entry.name;
+	result.buffer = pool.acquire(region.area() * entry.channels * CV_ELEM_SIZE1(entry.depth));
+
+	if (region.empty()) {
+		return result;
+	}
+
+	// ADIOS only touches the blocks that intersect the selection, which is what makes tiled region reads cheap.
+	// Whole images go through the shared cache, regions are always read from ADIOS.
+	const bool wholeImage = (region == cv::Rect(0, 0, entry.width, entry.height));
+	if (entry.slot < 0 && wholeImage) {
+		readImageCached(io, engine, cacheIdentity, entry.variable, entry.depth, {0, 0, 0}, {entry.height, entry.width, entry.channels}, result.buffer->data());
+	} else if (entry.slot < 0) {
+		getImageData(io, engine, entry.variable, entry.depth, {size_t(region.y), size_t(region.x), 0}, {size_t(region.height), size_t(region.width), entry.channels}, result.buffer->data());
+	} else if (wholeImage) {
+		readImageCached(io, engine, cacheIdentity, entry.variable, entry.depth, {size_t(entry.slot), 0, 0, 0}, {1, entry.height, entry.width, entry.channels}, result.buffer->data());
+	} else {
+		getImageData(io, engine, entry.variable, entry.depth, {size_t(entry.slot), size_t(region.y), size_t(region.x), 0}, {1, size_t(region.height), size_t(region.width), entry.channels}, result.buffer->data());
+	}
+
+	// Wrap the pooled buffer instead of copying it into a Mat of its own
+	result.image = cv::Mat(region.height, region.width, CV_MAKETYPE(entry.depth, entry.channels), result.buffer->data());
+	return result;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Dataset Epoch
+
+ImageDataset::Epoch::Epoch(ImageDataset& dataset, std::vector<size_t> order)
+	: dataset(dataset), order(order) {
+	size_t workerCount = std::min(dataset.workerCount, order.size());
+	for (size_t i = 0; i < workerCount; ++i) {
+		workers.push_back(std::thread(&Epoch::worker, this));
+	}
+}
+
+ImageDataset::Epoch::~Epoch() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	changed.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+bool ImageDataset::Epoch::next(DatasetImage& out) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (nextToConsume >= order.size()) {
+		return false;
+	}
+
+	changed.wait(lock, [this] { return ready.count(nextToConsume) != 0; });
+
+	auto slot = ready.find(nextToConsume);
+	out = slot->second;
+	ready.erase(slot);
+	++nextToConsume;
+
+	// A slot in the prefetch window has opened up
+	changed.notify_all();
+	return true;
+}
+
+void ImageDataset::Epoch::worker() {
+	// Failed reads are handed out as empty images rather than leaving the consumer waiting forever
+	auto failedImage = [this](size_t position) {
+		DatasetImage image;
+		image.name = dataset.name(order[position]);
+		image.buffer = std::make_shared<std::vector<uint8_t>>();
+		return image;
+	};
+
+	// Each worker reads through its own engine, ADIOS engines are not safe to share between threads
+	adios2::ADIOS adios;
+	adios2::IO io = adios.DeclareIO("dataset_prefetch");
+	adios2::Engine engine;
+
+	try {
+		engine = io.Open(dataset.bpPath, adios2::Mode::Read);
+	} catch (const std::exception& e) {
+		std::cerr << "Error: Failed to open " << dataset.bpPath << ": " << e.what() << std::endl;
+
+		// Without an engine no position can be read, so every one not yet claimed fails
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (; nextToFetch < order.size(); ++nextToFetch) {
+				ready[nextToFetch] = failedImage(nextToFetch);
+			}
+		}
+		changed.notify_all();
+		return;
+	}
+
+	while (true) {
+		size_t position;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [this] {
+				return stopping || nextToFetch >= order.size() || nextToFetch < nextToConsume + dataset.prefetchDepth;
+			});
+
+			if (stopping || nextToFetch >= order.size()) {
+				break;
+			}
+			position = nextToFetch++;
+		}
+
+		DatasetImage image;
+		try {
+			const Entry& entry = dataset.entries[order[position]];
+			image = dataset.read(io, engine, order[position], cv::Rect(0, 0, entry.width, entry.height));
+		} catch (const std::exception& e) {
+			std::cerr << "Error: Failed to read " << dataset.name(order[position]) << ": " << e.what() << std::endl;
+			image = failedImage(position);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			ready[position] = image;
+		}
+		changed.notify_all();
+	}
+
+	engine.Close();
+}
+
+//*****************************************************************************************************************************************************************
+
+// Get Experiment Location
+
+bool getExperimentLocation(const std::string& experimentName, std::string& adiosImagePath, std::string& variablePrefix, long& experimentId) {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
 
 	if (rc) {
 		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	if (!createExperimentTable(db)) {
+		sqlite3_close(db);
+		return false;
+	}
+
+	std::string query = "SELECT adios_image_path, variable_prefix, id FROM experiment_data WHERE experiment_name = ?;";
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		return false;
+	}
+
+	rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_finalize(stmt);
+		sqlite3_close(db);
+		return false;
+	}
+
+	bool found = (sqlite3_step(stmt) == SQLITE_ROW);
+	if (found) {
+		adiosImagePath = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+		variablePrefix = sqlite3_column_text(stmt, 1) ? reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)) : "";
+		experimentId = sqlite3_column_int64(stmt, 2);
+	} else {
+		std::cerr << "Error: Experiment not found in the database." << std::endl;
+	}
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+	return found;
+}
+
+std::map<std::string, adios2::Params> experimentVariables(adios2::IO& bpIO, const std::string& prefix) {
+	std::map<std::string, adios2::Params> variables;
+	for (const auto& variable : bpIO.AvailableVariables()) {
+		if (variable.first.compare(0, prefix.size(), prefix) == 0) {
+			variables[variable.first.substr(prefix.size())] = variable.second;
+		}
+	}
+	return variables;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Benchmark Reader
+
+void benchmarkReader() {
+	std::string experimentName;
+	std::cout << "Enter Experiment Name to Benchmark: ";
+	std::cin >> experimentName;
+
+	std::string adiosImagePath;
+	std::string variablePrefix;
+	long experimentId;
+	if (!getExperimentLocation(experimentName, adiosImagePath, variablePrefix, experimentId)) {
+		return;
+	}
+
+	ImageDataset dataset(adiosImagePath, 8, 2, 0, variablePrefix, experimentCacheIdentity(experimentId));
+	if (dataset.size() == 0) {
+		std::cout << "No images found in " << adiosImagePath << std::endl;
+		return;
+	}
+
+	std::cout << "Images: " << dataset.size() << "\n\n";
+
+	// Images that failed to read are counted separately instead of towards the throughput
+	size_t failed = 0;
+	auto report = [&dataset, &failed](const std::string& label, std::chrono::steady_clock::duration elapsed, size_t bytes) {
+		double seconds = std::chrono::duration<double>(elapsed).count();
+		std::cout << label << ": " << (dataset.size() - failed) / seconds << " images/s, "
+		          << bytes / seconds / (1024.0 * 1024.0) << " MB/s";
+		if (failed > 0) {
+			std::cout << ", " << failed << " failed";
+		}
+		std::cout << std::endl;
+		failed = 0;
+	};
+	auto count = [&failed](const DatasetImage& image, size_t& bytes) {
+		if (image.image.empty()) {
+			++failed;
+		} else {
+			bytes += image.buffer->size();
+		}
+	};
+
+	// Random access through operator[], one read at a time on the calling thread
+	size_t bytes = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < dataset.size(); ++i) {
+		count(dataset[i], bytes);
+	}
+	report("Sequential (operator[])", std::chrono::steady_clock::now() - start, bytes);
+
+	// Center crops covering a quarter of each image, tiled images only fetch the tiles underneath
+	bytes = 0;
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < dataset.size(); ++i) {
+		cv::Size size = dataset.imageSize(i);
+		count(dataset.region(i, cv::Rect(size.width / 4, size.height / 4, std::max(size.width / 2, 1), std::max(size.height / 2, 1))), bytes);
+	}
+	report("Center crop (region)", std::chrono::steady_clock::now() - start, bytes);
+
+	// Prefetched epochs, in file order and shuffled
+	for (int shuffle = 0; shuffle <= 1; ++shuffle) {
+		bytes = 0;
+		start = std::chrono::steady_clock::now();
+		auto epoch = dataset.epoch(shuffle == 1);
+		DatasetImage image;
+		while (epoch->next(image)) {
+			count(image, bytes);
+		}
+		report(shuffle ? "Shuffled (prefetched)" : "Sequential (prefetched)", std::chrono::steady_clock::now() - start, bytes);
+	}
+
+	// Thumbnails, only present when the experiment was ingested with downsampled levels
+	ImageDataset thumbnails(adiosImagePath, 8, 2, -1, variablePrefix, experimentCacheIdentity(experimentId));
+	if (thumbnails.size() == dataset.size()) {
+		bytes = 0;
+		start = std::chrono::steady_clock::now();
+		auto epoch = thumbnails.epoch(false);
+		DatasetImage image;
+		while (epoch->next(image)) {
+			count(image, bytes);
+		}
+		report("Thumbnails (prefetched)", std::chrono::steady_clock::now() - start, bytes);
+	}
+
+	// Statistics are shared by every process, a second run shows the throughput of a warm cache
+	SharedImageCache& cache = SharedImageCache::instance();
+	if (cache.enabled()) {
+		CacheStatistics statistics = cache.statistics();
+		std::cout << "\nShared image cache: " << statistics.hits << " hits, " << statistics.misses << " misses, " << statistics.evictions << " evictions" << std::endl;
+	}
+}
+
+//*****************************************************************************************************************************************************************
+
+// Benchmark Detection
+
+void benchmarkDetection() {
+	std::string rawPath;
+	std::cout << "Enter path to the directory containing raw images: ";
+	std::cin >> rawPath;
+
+	if (!fs::exists(rawPath) || !fs::is_directory(rawPath)) {
+		std::cout << "Error: The specified path does not exist or is not a directory." << std::endl;
 		return;
 	}
 
-	// Creates table if it doesnt already exist
+	std::vector<std::string> class_list = load_class_list();
+	std::vector<cv::dnn::Net> nets(INFERENCE_THREADS);
+	for (auto& net : nets) {
+		load_net(net, false);
+	}
 
-	std::string createTableQuery = "CREATE TABLE IF NOT EXISTS experiment_data ("
-		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-		                   "author_name TEXT, "
-		                   "experiment_name TEXT UNIQUE, "
-		                   "adios_image_path TEXT,"
-		                   "metadataContent TEXT);";
-	
-	// The function signature of the sqlite exec API expects 3 additional parameters that we dont need. These are callback function, arg to callback, and an error message
+	double singleTotal = 0, tiledTotal = 0;
+	size_t singleDetections = 0, tiledDetections = 0, images = 0;
+
+	for (const auto& entry : fs::directory_iterator(rawPath)) {
+		if (!fs::is_regular_file(entry.status())) {
+			continue;
+		}
+
+		cv::Mat image = cv::imread(entry.path().string());
+		if (image.empty()) {
+			continue;
+		}
 
-	rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, nullptr);
+		std::vector<Detection> single, tiled;
+
+		auto start = std::chrono::steady_clock::now();
+		detect(image, nets[0], single, class_list);
+		double singleMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		start = std::chrono::steady_clock::now();
+		detectTiled(image, nets, tiled, class_list);
+		double tiledMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << entry.path().filename().string() << " (" << image.cols << "x" << image.rows << "): "
+		          << "single " << singleMs << " ms, " << single.size() << " detections | "
+		          << "tiled " << tiledMs << " ms, " << tiled.size() << " detections" << std::endl;
+
+		singleTotal += singleMs;
+		tiledTotal += tiledMs;
+		singleDetections += single.size();
+		tiledDetections += tiled.size();
+		++images;
+	}
+
+	if (images == 0) {
+		std::cout << "No images found in " << rawPath << std::endl;
+		return;
+	}
+
+	std::cout << "\nSingle pass: " << singleTotal / images << " ms/image, " << singleDetections << " detections" << std::endl;
+	std::cout << "Tiled: " << tiledTotal / images << " ms/image, " << tiledDetections << " detections" << std::endl;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Create Hash Table
+
+bool createHashTable(sqlite3* db) {
+	// One index per 16-bit band of the hash is what makes the table a multi-index hashing index
+	std::string createTableQuery = "CREATE TABLE IF NOT EXISTS image_hashes ("
+		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
+		                   "experiment_name TEXT, "
+		                   "file_name TEXT, "
+		                   "phash INTEGER, "
+		                   "band0 INTEGER, "
+		                   "band1 INTEGER, "
+		                   "band2 INTEGER, "
+		                   "band3 INTEGER, "
+		                   "embedding BLOB);"
+		                   "CREATE INDEX IF NOT EXISTS image_hashes_band0 ON image_hashes (band0);"
+		                   "CREATE INDEX IF NOT EXISTS image_hashes_band1 ON image_hashes (band1);"
+		                   "CREATE INDEX IF NOT EXISTS image_hashes_band2 ON image_hashes (band2);"
+		                   "CREATE INDEX IF NOT EXISTS image_hashes_band3 ON image_hashes (band3);"
+		                   "CREATE INDEX IF NOT EXISTS image_hashes_experiment ON image_hashes (experiment_name);";
+
+	int rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, nullptr);
 
 	if (rc != SQLITE_OK) {
 		std::cerr << "Error: Failed to create table: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Insert Image Hashes
+
+void insertImageHashes(const std::string& experimentName, const std::vector<ImageHash>& hashes) {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
+
+	if (!createHashTable(db)) {
 		sqlite3_close(db);
 		return;
 	}
 
-	std::string sqlScript = "INSERT INTO experiment_data (author_name, experiment_name, adios_image_path, metadataContent) VALUES (?, ?, ?, ?);";
+	std::string sqlScript = "INSERT INTO image_hashes (experiment_name, file_name, phash, band0, band1, band2, band3, embedding) VALUES (?, ?, ?, ?, ?, ?, ?, ?);";
 	sqlite3_stmt* stmt;
 	rc = sqlite3_prepare_v2(db, sqlScript.c_str(), -1, &stmt, nullptr);
 
@@ -532,380 +3842,846 @@ void insertDataToDatabase(const std::string& authorName, const std::string& expe
 		return;
 	}
 
-	rc = sqlite3_bind_text(stmt, 1, authorName.c_str(), -1, SQLITE_STATIC);
+	// One transaction for the whole experiment instead of one per image
+	sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+	for (const auto& imageHash : hashes) {
+		sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_text(stmt, 2, imageHash.fileName.c_str(), -1, SQLITE_STATIC);
+		sqlite3_bind_int64(stmt, 3, sqlite3_int64(imageHash.phash));
+		for (int band = 0; band < 4; ++band) {
+			sqlite3_bind_int(stmt, 4 + band, int((imageHash.phash >> (16 * band)) & 0xFFFF));
+		}
+		if (imageHash.embedding.empty()) {
+			sqlite3_bind_null(stmt, 8);
+		} else {
+			sqlite3_bind_blob(stmt, 8, imageHash.embedding.data(), imageHash.embedding.size() * sizeof(float), SQLITE_STATIC);
+		}
+
+		rc = sqlite3_step(stmt);
+
+		if (rc != SQLITE_DONE) {
+			std::cerr << "Error: Failed to execute query: " << sqlite3_errmsg(db) << std::endl;
+		}
+
+		sqlite3_reset(stmt);
+	}
+
+	sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Find Similar Images
+
+void bandVariants(int value, int radius, int firstBit, std::vector<int>& variants) {
+	variants.push_back(value);
+	if (radius == 0) {
 		return;
 	}
+	for (int bit = firstBit; bit < 16; ++bit) {
+		bandVariants(value ^ (1 << bit), radius - 1, bit + 1, variants);
+	}
+}
 
-	rc = sqlite3_bind_text(stmt, 2, experimentName.c_str(), -1, SQLITE_STATIC);
+// Beyond 11 differing bits of 64 images are no longer near-duplicates, and the candidate set grows steeply
+const int MAX_BAND_RADIUS = 2;
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_finalize(stmt);
+void findSimilarImages() {
+	std::string imagePath;
+	size_t k;
+
+	std::cout << "Enter path to the query image: ";
+	std::cin >> imagePath;
+
+	std::cout << "Enter number of matches to return: ";
+	std::cin >> k;
+
+	cv::Mat image = cv::imread(imagePath, cv::IMREAD_UNCHANGED);
+	if (image.empty()) {
+		std::cerr << "Error: Couldn't open or read the image at " << imagePath << std::endl;
+		return;
+	}
+
+	const uint64_t hash = perceptualHash(image);
+
+	std::vector<float> embedding;
+	if (!EMBEDDING_LAYER.empty()) {
+		cv::dnn::Net net;
+		load_net(net, false);
+		if (hasEmbeddingLayer(net)) {
+			embedding = computeEmbedding(image, net);
+		}
+	}
+
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
+
+	if (!createHashTable(db)) {
 		sqlite3_close(db);
 		return;
 	}
 
-	rc = sqlite3_bind_text(stmt, 3, adiosOutputPath.c_str(), -1, SQLITE_STATIC);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<SimilarImage> matches;
+
+	// With four bands, any hash within 4 * radius + 3 bits of the query matches one band within radius bits.
+	// The radius grows until that guarantee covers k matches, so the top k are exact up to MAX_BAND_RADIUS.
+	for (int radius = 0; radius <= MAX_BAND_RADIUS; ++radius) {
+		std::string query = "SELECT experiment_name, file_name, phash, embedding FROM image_hashes WHERE ";
+		for (int band = 0; band < 4; ++band) {
+			std::vector<int> variants;
+			bandVariants(int((hash >> (16 * band)) & 0xFFFF), radius, 0, variants);
+
+			query += (band > 0 ? " OR band" : "band") + std::to_string(band) + " IN (";
+			for (size_t i = 0; i < variants.size(); ++i) {
+				query += (i > 0 ? "," : "") + std::to_string(variants[i]);
+			}
+			query += ")";
+		}
+		query += ";";
+
+		sqlite3_stmt* stmt;
+		rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+
+		if (rc != SQLITE_OK) {
+			std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+			sqlite3_close(db);
+			return;
+		}
+
+		matches.clear();
+		size_t guaranteed = 0;
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			SimilarImage match;
+			match.experimentName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+			match.fileName = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+			match.distance = __builtin_popcountll(hash ^ uint64_t(sqlite3_column_int64(stmt, 2)));
+			match.similarity = 0;
+
+			const float* candidate = static_cast<const float*>(sqlite3_column_blob(stmt, 3));
+			const size_t candidateSize = sqlite3_column_bytes(stmt, 3) / sizeof(float);
+			if (candidate != nullptr && candidateSize == embedding.size()) {
+				for (size_t i = 0; i < candidateSize; ++i) {
+					match.similarity += candidate[i] * embedding[i];
+				}
+			}
+
+			if (match.distance <= 4 * radius + 3) {
+				++guaranteed;
+			}
+			matches.push_back(match);
+		}
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
 		sqlite3_finalize(stmt);
+
+		if (guaranteed >= k) {
+			break;
+		}
+	}
+
+	sqlite3_close(db);
+
+	// Hamming distance decides, embeddings break ties between equally close hashes
+	std::sort(matches.begin(), matches.end(), [](const SimilarImage& a, const SimilarImage& b) {
+		return a.distance != b.distance ? a.distance < b.distance : a.similarity > b.similarity;
+	});
+	if (matches.size() > k) {
+		matches.resize(k);
+	}
+
+	double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	for (size_t i = 0; i < matches.size(); ++i) {
+		std::cout << i + 1 << ") " << matches[i].experimentName << " / " << matches[i].fileName
+		          << " (distance " << matches[i].distance;
+		if (!embedding.empty()) {
+			std::cout << ", similarity " << matches[i].similarity;
+		}
+		std::cout << ")" << std::endl;
+	}
+
+	if (matches.empty()) {
+		std::cout << "No similar images found." << std::endl;
+	}
+	std::cout << "\nQuery took " << elapsed << " ms" << std::endl;
+}
+
+//*****************************************************************************************************************************************************************
+
+// Shared Containers
+
+bool reserveContainerSlot(const std::string& experimentName, int& containerId, std::string& variablePrefix) {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	sqlite3_busy_timeout(db, 5000);
+
+	if (!createExperimentTable(db)) {
 		sqlite3_close(db);
-		return;
+		return false;
 	}
 
-	rc = sqlite3_bind_text(stmt, 4, metadataContent.c_str(), -1, SQLITE_STATIC);
+	// IMMEDIATE takes the write lock up front, so two ingests never get the same slot
+	rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
 
 	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_finalize(stmt);
+		std::cerr << "Error: Failed to begin transaction: " << sqlite3_errmsg(db) << std::endl;
 		sqlite3_close(db);
-		return;
+		return false;
 	}
 
-	rc = sqlite3_step(stmt);
+	std::string query = "SELECT id, slots FROM containers c WHERE (SELECT COUNT(*) FROM experiment_data e WHERE e.adios_image_path = c.path) < ? ORDER BY id DESC LIMIT 1;";
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
 
-	if (rc != SQLITE_DONE) {
-		std::cerr << "Error: Failed to execute query: " << sqlite3_errmsg(db) << std::endl;
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		return false;
 	}
 
+	sqlite3_bind_int(stmt, 1, CONTAINER_CAPACITY);
+
+	containerId = -1;
+	long slot = 0;
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		containerId = sqlite3_column_int(stmt, 0);
+		slot = sqlite3_column_int64(stmt, 1);
+	}
 	sqlite3_finalize(stmt);
+
+	if (containerId < 0) {
+		// The row is inserted first to allocate the id that names the file
+		if (!runStatement(db, "INSERT INTO containers (path, slots) VALUES (NULL, 0);", {})) {
+			sqlite3_close(db);
+			return false;
+		}
+		containerId = sqlite3_last_insert_rowid(db);
+
+		if (!runStatement(db, "UPDATE containers SET path = ? WHERE id = ?;", {CONTAINER_DIRECTORY + "container_" + std::to_string(containerId) + ".bp", std::to_string(containerId)})) {
+			sqlite3_close(db);
+			return false;
+		}
+	}
+
+	if (!runStatement(db, "UPDATE containers SET slots = slots + 1 WHERE id = ?;", {std::to_string(containerId)})) {
+		sqlite3_close(db);
+		return false;
+	}
+
+	sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+
+	// Slots are never reused, so the tombstoned variables of a deleted experiment cannot clash with a new one of the same name
+	variablePrefix = experimentName + "@" + std::to_string(slot) + "/";
 	sqlite3_close(db);
+	return true;
 }
 
-//*****************************************************************************************************************************************************************
+int appendToContainer(int containerId, const std::string& stagingPath, const std::string& variablePrefix, std::string& containerPath) {
+	// Compaction holds the lock while it copies the whole container, the ingest waits for it rather than losing its converted images
+	int lock = lockContainer(containerId, -1);
+	if (lock < 0) {
+		return -1;
+	}
 
-// Check DB
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
 
-bool checkdb(const std::string& experimentName) {
-    sqlite3* db;
-    int exit = 0;
-    exit = sqlite3_open("data.db", &db);
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		close(lock);
+		return -1;
+	}
 
-    if (exit) {
-        std::cout << "Error: Can't open database: \n" << sqlite3_errmsg(db) << std::endl;
-        std::exit(0);
-    }
+	sqlite3_busy_timeout(db, 5000);
 
-	std::string createTableQuery = "CREATE TABLE IF NOT EXISTS experiment_data ("
-		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-		                   "author_name TEXT, "
-		                   "experiment_name TEXT UNIQUE, "
-		                   "adios_image_path TEXT,"
-		                   "metadataContent TEXT);";
-	
-    int rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, nullptr);
+	// The path is read under the lock, since compaction may have replaced the container in the meantime
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, "SELECT path FROM containers WHERE id = ?;", -1, &stmt, nullptr);
 
-    if (rc != SQLITE_OK) {
-        std::cout << "Error: Failed to create table: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        std::exit(0);        
-    }
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		close(lock);
+		sqlite3_close(db);
+		return -1;
+	}
 
-    std::string query = "SELECT experiment_name FROM experiment_data WHERE experiment_name = ?;";
-    sqlite3_stmt* stmt;
+	containerPath.clear();
+	sqlite3_bind_int(stmt, 1, containerId);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		containerPath = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_close(db);
 
-    rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+	if (containerPath.empty()) {
+		std::cerr << "Error: Container " << containerId << " not found in the database." << std::endl;
+		close(lock);
+		return -1;
+	}
 
-    if (rc != SQLITE_OK) {
-        std::cout << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        std::exit(0);        
-    }
+	// BP4 appends the experiment to the existing container as a new step
+	try {
+		adios2::ADIOS adios;
+		adios2::IO sourceIO = adios.DeclareIO("staging_read");
+		adios2::Engine bpReader = sourceIO.Open(stagingPath, adios2::Mode::Read);
+
+		adios2::IO targetIO = adios.DeclareIO("container_append");
+		targetIO.SetEngine("bp4");
+		adios2::Engine bpWriter = targetIO.Open(containerPath, fs::exists(containerPath) ? adios2::Mode::Append : adios2::Mode::Write);
+
+		copyExperiment(sourceIO, bpReader, targetIO, bpWriter, variablePrefix);
+		bpWriter.Close();
+		bpReader.Close();
+	} catch (const std::exception& e) {
+		// Whatever was appended has no catalog row, the tombstone lets compaction reclaim it
+		std::cerr << "Error: Failed to append to " << containerPath << ": " << e.what() << std::endl;
+		tombstoneExperiment(containerPath, variablePrefix);
+		close(lock);
+		return -1;
+	}
 
-    rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+	std::cout << "Packed into " << containerPath << " as '" << variablePrefix << "'" << std::endl;
+	return lock;
+}
 
-    if (rc != SQLITE_OK) {
-        std::cout << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        std::exit(0);        
-    }
+int lockContainer(int containerId, int waitSeconds) {
+	// Locks are keyed by id rather than path, which changes with every compaction
+	fs::create_directories(CONTAINER_DIRECTORY);
+	const std::string lockPath = CONTAINER_DIRECTORY + "container_" + std::to_string(containerId) + ".lock";
 
-    rc = sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+	int descriptor = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+	if (descriptor < 0) {
+		std::cerr << "Error: Can't open lock file " << lockPath << std::endl;
+		return -1;
+	}
 
-    return (rc == SQLITE_ROW);
+	if (waitSeconds < 0) {
+		if (flock(descriptor, LOCK_EX) != 0) {
+			std::cerr << "Error: Can't lock " << lockPath << std::endl;
+			close(descriptor);
+			return -1;
+		}
+		return descriptor;
+	}
+
+	// Polls rather than blocks, so a container held by a long compaction or a stuck process is reported instead of hanging
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(waitSeconds);
+	while (flock(descriptor, LOCK_EX | LOCK_NB) != 0) {
+		if (errno != EWOULDBLOCK && errno != EINTR) {
+			std::cerr << "Error: Can't lock " << lockPath << std::endl;
+			close(descriptor);
+			return -1;
+		}
+		if (std::chrono::steady_clock::now() >= deadline) {
+			std::cerr << "Error: Container " << containerId << " is still locked by another process after " << waitSeconds << "s, try again later" << std::endl;
+			close(descriptor);
+			return -1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	return descriptor;
+}
+
+int lockContainerAt(sqlite3* db, const std::string& containerPath) {
+	sqlite3_stmt* stmt;
+	int rc = sqlite3_prepare_v2(db, "SELECT id FROM containers WHERE path = ?;", -1, &stmt, nullptr);
+
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		return -1;
+	}
+
+	int containerId = -1;
+	sqlite3_bind_text(stmt, 1, containerPath.c_str(), -1, SQLITE_STATIC);
+	if (sqlite3_step(stmt) == SQLITE_ROW) {
+		containerId = sqlite3_column_int(stmt, 0);
+	}
+	sqlite3_finalize(stmt);
+
+	if (containerId < 0) {
+		std::cerr << "Error: No container at " << containerPath << std::endl;
+		return -1;
+	}
+	return lockContainer(containerId, CONTAINER_LOCK_WAIT_SECONDS);
+}
+
+bool tombstoneExperiment(const std::string& containerPath, const std::string& variablePrefix) {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
+
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return false;
+	}
+
+	sqlite3_busy_timeout(db, 5000);
+
+	const bool recorded = createExperimentTable(db)
+		&& runStatement(db, "INSERT INTO container_tombstones (container_path, variable_prefix) VALUES (?, ?);", {containerPath, variablePrefix});
+	sqlite3_close(db);
+	return recorded;
 }
 
 //*****************************************************************************************************************************************************************
 
-// Retrieve Data from User, Convert Image and Insert Into Database
+// Copy Experiment
 
-void insertDataAndGetPath() {
-	std::string experimentName;
-	std::string rawImagesPath;
-	std::string authorName;
+void copyExperiment(adios2::IO& sourceIO, adios2::Engine& bpReader, adios2::IO& targetIO, adios2::Engine& bpWriter, const std::string& prefix) {
+	std::vector<uint8_t> buffer;
 
-	std::cout << "Enter Experiment Name: ";
-	std::cin >> experimentName;
+	for (const auto& variable : experimentVariables(sourceIO, prefix)) {
+		const std::string variableName = prefix + variable.first;
+		int depth;
+		adios2::Dims shape;
+		if (!inquireImageVariable(sourceIO, variableName, depth, shape)) {
+			continue;
+		}
 
-	if (checkdb(experimentName)) {
-		std::cout << "Experiment already exists in the database!" << std::endl;
-		return;
+		// Blocks are copied one at a time in their original layout, so tiled region reads and per-frame group reads stay as cheap as before
+		const size_t elementSize = CV_ELEM_SIZE1(depth);
+		auto tileAttribute = sourceIO.InquireAttribute<int>(variableName + "/tile_size");
+
+		if (shape.size() == 3 && tileAttribute) {
+			const size_t tile = tileAttribute.Data()[0];
+			for (size_t y = 0; y < shape[0]; y += tile) {
+				for (size_t x = 0; x < shape[1]; x += tile) {
+					const adios2::Dims start = {y, x, 0};
+					const adios2::Dims count = {std::min(tile, shape[0] - y), std::min(tile, shape[1] - x), shape[2]};
+					buffer.resize(count[0] * count[1] * count[2] * elementSize);
+					getImageData(sourceIO, bpReader, variableName, depth, start, count, buffer.data());
+					putImageData(targetIO, bpWriter, variableName, depth, shape, start, count, buffer.data());
+				}
+			}
+		} else if (shape.size() == 4) {
+			buffer.resize(shape[1] * shape[2] * shape[3] * elementSize);
+			for (size_t slot = 0; slot < shape[0]; ++slot) {
+				getImageData(sourceIO, bpReader, variableName, depth, {slot, 0, 0, 0}, {1, shape[1], shape[2], shape[3]}, buffer.data());
+				putImageData(targetIO, bpWriter, variableName, depth, shape, {slot, 0, 0, 0}, {1, shape[1], shape[2], shape[3]}, buffer.data());
+			}
+		} else {
+			size_t elements = 1;
+			for (size_t extent : shape) {
+				elements *= extent;
+			}
+			buffer.resize(elements * elementSize);
+			const adios2::Dims start(shape.size(), 0);
+			getImageData(sourceIO, bpReader, variableName, depth, start, shape, buffer.data());
+			putImageData(targetIO, bpWriter, variableName, depth, shape, start, shape, buffer.data());
+		}
 	}
 
-	std::cout << "Enter Author Name: ";
-	std::cin >> authorName;
-
-	std::cout << "Enter path to the directory containing raw images: ";
-	std::cin >> rawImagesPath;
-	
-	std::cout << "\n";
-	std::string outputPath;
-	std::string metadataContent;
-	
-
-	ConversionResult result = convert_images(experimentName, rawImagesPath);
-	outputPath = result.outputPath;
-	metadataContent = result.metadataContent;
+	// Ingest writes the metadata and group names as strings and tile sizes as ints
+	for (const auto& attribute : sourceIO.AvailableAttributes()) {
+		const std::string& attributeName = attribute.first;
+		if (attributeName.compare(0, prefix.size(), prefix) != 0) {
+			continue;
+		}
 
-	if(outputPath != "Error") {
-		std::cout << "\nBP File Location: " << outputPath;
-		insertDataToDatabase(authorName, experimentName, outputPath, metadataContent);
-	}
-	else {
-		std::cout << "Error!";
-		return;
+		const std::string type = sourceIO.AttributeType(attributeName);
+		if (type == "string") {
+			const std::vector<std::string> values = sourceIO.InquireAttribute<std::string>(attributeName).Data();
+			const bool isNameList = attributeName.size() >= 6 && attributeName.compare(attributeName.size() - 6, 6, "/names") == 0;
+			if (isNameList) {
+				targetIO.DefineAttribute<std::string>(attributeName, values.data(), values.size());
+			} else if (!values.empty()) {
+				targetIO.DefineAttribute<std::string>(attributeName, values[0]);
+			}
+		} else if (type == "int32_t") {
+			const std::vector<int> values = sourceIO.InquireAttribute<int>(attributeName).Data();
+			if (!values.empty()) {
+				targetIO.DefineAttribute<int>(attributeName, values[0]);
+			}
+		}
 	}
 }
 
 //*****************************************************************************************************************************************************************
 
-// Query All Data
+// Compact Containers
 
-bool queryAllData() {
-    sqlite3* db;
-    int exit = 0;
-    exit = sqlite3_open("data.db", &db);
+bool compactContainer(int containerId) {
+	int lock = lockContainer(containerId, CONTAINER_LOCK_WAIT_SECONDS);
+	if (lock < 0) {
+		return false;
+	}
 
-    if (exit) {
-        std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
-        return false;
-    }
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
 
-	std::string createTableQuery = "CREATE TABLE IF NOT EXISTS experiment_data ("
-		                   "id INTEGER PRIMARY KEY AUTOINCREMENT, "
-		                   "author_name TEXT, "
-		                   "experiment_name TEXT UNIQUE, "
-		                   "adios_image_path TEXT,"
-		                   "metadataContent TEXT);";
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		close(lock);
+		return false;
+	}
 
-    int rc = sqlite3_exec(db, createTableQuery.c_str(), nullptr, nullptr, nullptr);
+	sqlite3_busy_timeout(db, 5000);
 
-    if (rc != SQLITE_OK) {
-        std::cerr << "Error: Failed to create table: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return false;
-    }
+	std::string containerPath;
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, "SELECT path FROM containers WHERE id = ?;", -1, &stmt, nullptr);
 
-    std::string query = "SELECT * FROM experiment_data;";
-    sqlite3_stmt* stmt;
-    rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_int(stmt, 1, containerId);
+		if (sqlite3_step(stmt) == SQLITE_ROW) {
+			containerPath = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+		}
+		sqlite3_finalize(stmt);
+	}
 
-    if (rc != SQLITE_OK) {
-        std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return false;
-    }
+	// Live experiments are the catalog rows still pointing at the container, tombstoned ones have lost theirs
+	std::vector<std::string> prefixes;
+	rc = sqlite3_prepare_v2(db, "SELECT variable_prefix FROM experiment_data WHERE adios_image_path = ?;", -1, &stmt, nullptr);
 
-    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-        std::cout << "Author Name: " << sqlite3_column_text(stmt, 1) << std::endl;
-        std::cout << "Experiment Name: " << sqlite3_column_text(stmt, 2) << std::endl;
-        std::cout << "Adios Image Path: " << sqlite3_column_text(stmt, 3) << std::endl;
-        std::cout << "MetaData: \n" << sqlite3_column_text(stmt, 4) << std::endl;
-        std::cout << "-----------------------------" << std::endl;
-    }
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_text(stmt, 1, containerPath.c_str(), -1, SQLITE_STATIC);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			prefixes.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+		}
+		sqlite3_finalize(stmt);
+	}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+	if (rc != SQLITE_OK || containerPath.empty()) {
+		std::cerr << "Error: Failed to look up container " << containerId << ": " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		close(lock);
+		return false;
+	}
 
-    return true;
-}
+	// Generations already on disk may still be read through, so the copy always gets a fresh name
+	std::string compactedPath;
+	for (int generation = 1; compactedPath.empty() || fs::exists(compactedPath); ++generation) {
+		compactedPath = CONTAINER_DIRECTORY + "container_" + std::to_string(containerId) + "." + std::to_string(generation) + ".bp";
+	}
 
-//*****************************************************************************************************************************************************************
+	try {
+		adios2::ADIOS adios;
+		adios2::IO sourceIO = adios.DeclareIO("compact_read");
+		adios2::Engine bpReader = sourceIO.Open(containerPath, adios2::Mode::Read);
 
-// Extract Images from Folder
+		adios2::IO targetIO = adios.DeclareIO("compact_write");
+		targetIO.SetEngine("bp4");
+		adios2::Engine bpWriter = targetIO.Open(compactedPath, adios2::Mode::Write);
 
-void extractImages() {
-    sqlite3* db;
-    int exit = 0;
-    exit = sqlite3_open("data.db", &db);
-	
-    if (exit) {
-        std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
-        return;
-    }
+		for (const auto& prefix : prefixes) {
+			copyExperiment(sourceIO, bpReader, targetIO, bpWriter, prefix);
+		}
 
-    queryAllData();
+		bpWriter.Close();
+		bpReader.Close();
+	} catch (const std::exception& e) {
+		std::cerr << "Error: Failed to compact " << containerPath << ": " << e.what() << std::endl;
+		fs::remove_all(compactedPath);
+		sqlite3_close(db);
+		close(lock);
+		return false;
+	}
 
-    std::string experimentName;
-    std::cout << "Enter Experiment Name to Extract Images: ";
-    std::cin >> experimentName;
-    
-    std::string query = "SELECT adios_image_path FROM experiment_data WHERE experiment_name = ?;";
-    sqlite3_stmt* stmt;
-    int rc = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+	// Readers resolve paths through the catalog, so switching the rows in one transaction moves them all to the copy at once.
+	// Closing the connection without a COMMIT rolls back a partial switch.
+	const bool switched = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr) == SQLITE_OK
+		&& runStatement(db, "UPDATE experiment_data SET adios_image_path = ? WHERE adios_image_path = ?;", {compactedPath, containerPath})
+		&& runStatement(db, "UPDATE containers SET path = ? WHERE id = ?;", {compactedPath, std::to_string(containerId)})
+		&& runStatement(db, "DELETE FROM container_tombstones WHERE container_path = ?;", {containerPath})
+		&& runStatement(db, "INSERT INTO retired_containers (path, retired_at) VALUES (?, strftime('%s', 'now'));", {containerPath})
+		&& sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK;
 
-    if (rc != SQLITE_OK) {
-        std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_close(db);
-        return;
-    }
+	sqlite3_close(db);
+	close(lock);
 
-    rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+	if (!switched) {
+		std::cerr << "Error: Failed to switch the catalog to " << compactedPath << std::endl;
+		fs::remove_all(compactedPath);
+		return false;
+	}
 
-    if (rc != SQLITE_OK) {
-        std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return;
-    }
+	size_t bytesBefore, bytesAfter, entries;
+	directoryUsage(containerPath, bytesBefore, entries);
+	directoryUsage(compactedPath, bytesAfter, entries);
 
-    rc = sqlite3_step(stmt);
+	std::ostringstream report;
+	report << "Compacted " << containerPath << " into " << compactedPath << ": " << prefixes.size() << " live experiments, "
+	       << bytesBefore / (1024.0 * 1024.0) << " MB -> " << bytesAfter / (1024.0 * 1024.0) << " MB\n";
+	std::cout << report.str();
+	return true;
+}
 
-    if (rc != SQLITE_ROW) {
-        std::cerr << "Error: Experiment not found in the database." << std::endl;
-        sqlite3_finalize(stmt);
-        sqlite3_close(db);
-        return;
-    }
+void compactContainers() {
+	sqlite3* db;
+	int rc = sqlite3_open("data.db", &db);
 
-    std::string adiosImagePath(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-    std::cout << "BP File Path: " << adiosImagePath << "\n\n";
-	
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+	if (rc) {
+		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+		return;
+	}
 
-    adios2::ADIOS adios;
-    adios2::IO bpIO = adios.DeclareIO("image_read");
-    adios2::Engine bpReader = bpIO.Open(adiosImagePath, adios2::Mode::Read);
+	sqlite3_busy_timeout(db, 5000);
 
+	if (!createExperimentTable(db)) {
+		sqlite3_close(db);
+		return;
+	}
 
-    const std::map<std::string, adios2::Params> varss = bpIO.AvailableVariables();
-    std::string output_folder = "/home/pbhatia4/Desktop/Adios2C-Implementation/Data-Output/" + experimentName + "/";
-    fs::create_directories(output_folder);
+	std::vector<int> containerIds;
+	sqlite3_stmt* stmt;
+	rc = sqlite3_prepare_v2(db, "SELECT DISTINCT c.id FROM containers c JOIN container_tombstones t ON t.container_path = c.path;", -1, &stmt, nullptr);
 
-    for (const auto& variable_name : varss) {
-        auto bpImage = bpIO.InquireVariable(variable_name.first);
-        if (bpImage) {
-            std::cout << "Reading " << variable_name.first << std::endl;
-            auto shape = bpImage.Shape();
-            size_t height = shape[0];
-            size_t width = shape[1];
-            size_t channels = shape[2];
+	if (rc != SQLITE_OK) {
+		std::cerr << "Error: Failed to prepare query: " << sqlite3_errmsg(db) << std::endl;
+		sqlite3_close(db);
+		return;
+	}
 
-            std::vector<uint8_t> myImage(height * width * channels);
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		containerIds.push_back(sqlite3_column_int(stmt, 0));
+	}
+	sqlite3_finalize(stmt);
 
-            bpImage.SetSelection({{0, 0, 0}, {height, width, channels}});
-            bpReader.Get(bpImage, myImage.data(), adios2::Mode::Sync);
+	std::cout << "Containers with tombstones: " << containerIds.size() << "\n\n";
+
+	// Containers are rewritten in parallel, each under its own lock; readers carry on against the old files meanwhile
+	std::mutex mutex;
+	size_t next = 0;
+	size_t compacted = 0;
+	std::vector<std::thread> workers;
+	const size_t workerCount = std::min<size_t>(containerIds.size(), std::max(1u, std::thread::hardware_concurrency()));
+
+	for (size_t i = 0; i < workerCount; ++i) {
+		workers.push_back(std::thread([&] {
+			while (true) {
+				int containerId;
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (next >= containerIds.size()) {
+						break;
+					}
+					containerId = containerIds[next++];
+				}
 
-            if (channels < 3) {
-                myImage.resize(height * width * 3);
-                std::fill(myImage.begin() + channels, myImage.end(), 0);
-            }
+				const bool done = compactContainer(containerId);
 
-            cv::Mat image(height, width, (channels == 3) ? CV_8UC3 : CV_8UC1, myImage.data());
-            cv::imwrite(output_folder + variable_name.first, image);
-        }
-    }
+				std::lock_guard<std::mutex> lock(mutex);
+				compacted += done ? 1 : 0;
+			}
+		}));
+	}
 
-	adios2::Attribute<std::string> metadataAttribute;
+	for (auto& worker : workers) {
+		worker.join();
+	}
 
-	// Inquire the attribute from the BP file
-	metadataAttribute = bpIO.InquireAttribute<std::string>("metadata");
+	// Replaced containers are only removed once no reader can still be working from a path looked up before the switch
+	std::vector<std::string> retired;
+	rc = sqlite3_prepare_v2(db, "SELECT path FROM retired_containers WHERE retired_at < strftime('%s', 'now') - ?;", -1, &stmt, nullptr);
 
-	// Check if the attribute exists
-	if (metadataAttribute) {
-	    // Retrieve the data associated with the attribute
-	    const std::vector<std::string>& metadataValues = metadataAttribute.Data();
+	if (rc == SQLITE_OK) {
+		sqlite3_bind_int(stmt, 1, CONTAINER_RETIRE_SECONDS);
+		while (sqlite3_step(stmt) == SQLITE_ROW) {
+			retired.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+		}
+		sqlite3_finalize(stmt);
+	}
 
-	    // Process the retrieved data as needed
-	    if (!metadataValues.empty()) {
-		std::string metadataValue = metadataValues[0];
-		std::cout << "\nInquired Attribute Value: \n" << metadataValue << std::endl;
-		std::ofstream metadataFile(output_folder + "metadata.txt");
-		metadataFile << metadataValue;
-		metadataFile.close();
-		std::cout << "Metadata Extracted at: " << output_folder << "metadata.txt";
-	    }
-	} else {
-		std::cerr << "Error: Attribute 'metadata' not found." << std::endl;
+	for (const auto& path : retired) {
+		fs::remove_all(path);
+		runStatement(db, "DELETE FROM retired_containers WHERE path = ?;", {path});
 	}
 
-    bpReader.Close();
-    
-    std::cout << "\nImages Recreated at: " << output_folder << std::endl;
+	sqlite3_close(db);
 
+	std::cout << "\nCompacted " << compacted << " of " << containerIds.size() << " containers, removed " << retired.size() << " retired containers" << std::endl;
 }
 
 //*****************************************************************************************************************************************************************
 
-// Delete Experiment
+// Directory Usage
 
-void deleteExperiment() {
-	sqlite3* db;
-	int exit = 0;
-	exit = sqlite3_open("data.db", &db);
+void directoryUsage(const std::string& path, size_t& bytes, size_t& entries) {
+	bytes = 0;
+	entries = 0;
 
-	if (exit) {
-		std::cerr << "Error: Can't open database: " << sqlite3_errmsg(db) << std::endl;
+	if (!fs::exists(path)) {
 		return;
 	}
 
-	queryAllData();
+	if (fs::is_regular_file(path)) {
+		bytes = fs::file_size(path);
+		entries = 1;
+		return;
+	}
 
-	std::string experimentName;
-	std::cout << "Enter Experiment Name to Delete: ";
-	std::cin >> experimentName;
+	// Directories are counted too, they cost the filesystem metadata just like files
+	for (const auto& entry : fs::recursive_directory_iterator(path)) {
+		if (fs::is_regular_file(entry.status())) {
+			bytes += fs::file_size(entry.path());
+		}
+		++entries;
+	}
+}
 
+//*****************************************************************************************************************************************************************
 
-	if (!checkdb(experimentName)) {
-		std::cout << "Experiment Does Not Exist!" << std::endl;		
+// Benchmark Containers
+
+void benchmarkContainers() {
+	size_t experimentCount;
+	std::cout << "Enter number of experiments to generate (e.g. 10000): ";
+	std::cin >> experimentCount;
+
+	if (experimentCount == 0) {
 		return;
 	}
 
-	std::string deleteQuery = "DELETE FROM experiment_data WHERE experiment_name = ?;";
-	sqlite3_stmt* stmt;
-	int rc = sqlite3_prepare_v2(db, deleteQuery.c_str(), -1, &stmt, nullptr);
+	const std::string benchmarkPath = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/container_benchmark/";
+	const size_t imagesPerExperiment = 4;
+	const size_t samples = std::min<size_t>(100, experimentCount);
+	fs::remove_all(benchmarkPath);
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to prepare delete query: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_close(db);
-		return;
+	// Small random images stand in for the experiments whose file count is the problem
+	std::vector<cv::Mat> images(imagesPerExperiment);
+	for (auto& image : images) {
+		image = cv::Mat(64, 64, CV_8UC3);
+		cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
 	}
 
-	rc = sqlite3_bind_text(stmt, 1, experimentName.c_str(), -1, SQLITE_STATIC);
+	// Experiment e gets a file of its own, or the prefix ingest would give it in container e / CONTAINER_CAPACITY
+	auto separatePath = [&benchmarkPath](size_t e) { return benchmarkPath + "separate/experiment_" + std::to_string(e) + "/images.bp"; };
+	auto containerPath = [&benchmarkPath](size_t e) { return benchmarkPath + "containers/container_" + std::to_string(e / CONTAINER_CAPACITY) + ".bp"; };
+	auto containerPrefix = [](size_t e) { return "experiment_" + std::to_string(e) + "@" + std::to_string(e % CONTAINER_CAPACITY) + "/"; };
 
-	if (rc != SQLITE_OK) {
-		std::cerr << "Error: Failed to bind parameters: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
-		return;
+	std::mt19937 generator(42);
+	std::vector<size_t> sampled(samples);
+	for (auto& e : sampled) {
+		e = generator() % experimentCount;
 	}
 
-	rc = sqlite3_step(stmt);
+	for (int packed = 0; packed <= 1; ++packed) {
+		auto start = std::chrono::steady_clock::now();
+
+		for (size_t e = 0; e < experimentCount; ++e) {
+			const std::string path = packed ? containerPath(e) : separatePath(e);
+			const std::string prefix = packed ? containerPrefix(e) : "";
+			fs::create_directories(fs::path(path).parent_path());
+
+			adios2::ADIOS adios;
+			adios2::IO bpIO = adios.DeclareIO("benchmark_write");
+			adios2::Mode mode = adios2::Mode::Write;
+			if (packed) {
+				bpIO.SetEngine("bp4");
+				if (fs::exists(path)) {
+					mode = adios2::Mode::Append;
+				}
+			} else {
+				bpIO.SetEngine("bp3");
+			}
 
-	if (rc != SQLITE_DONE) {
-		std::cerr << "Error: Failed to execute delete query: " << sqlite3_errmsg(db) << std::endl;
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+			adios2::Engine bpWriter = bpIO.Open(path, mode);
+			for (size_t i = 0; i < images.size(); ++i) {
+				const size_t height = images[i].rows;
+				const size_t width = images[i].cols;
+				putImageData(bpIO, bpWriter, prefix + "image_" + std::to_string(i) + ".png", CV_8U, {height, width, 3}, {0, 0, 0}, {height, width, 3}, images[i].data);
+			}
+			bpIO.DefineAttribute<std::string>(prefix + "metadata", "benchmark");
+			bpWriter.Close();
+		}
+
+		const double writeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		// Each sample opens, lists and extracts one experiment from scratch, as query and extract do
+		double openMs = 0, listMs = 0, extractMs = 0;
+		for (size_t e : sampled) {
+			const std::string path = packed ? containerPath(e) : separatePath(e);
+			const std::string prefix = packed ? containerPrefix(e) : "";
+
+			adios2::ADIOS adios;
+			adios2::IO bpIO = adios.DeclareIO("benchmark_read");
+
+			auto phaseStart = std::chrono::steady_clock::now();
+			adios2::Engine bpReader = bpIO.Open(path, adios2::Mode::Read);
+			auto opened = std::chrono::steady_clock::now();
+
+			const std::map<std::string, adios2::Params> variables = experimentVariables(bpIO, prefix);
+			auto listed = std::chrono::steady_clock::now();
+
+			for (const auto& variable : variables) {
+				int depth;
+				adios2::Dims shape;
+				if (!inquireImageVariable(bpIO, prefix + variable.first, depth, shape) || shape.size() != 3) {
+					continue;
+				}
+				cv::Mat image(shape[0], shape[1], CV_MAKETYPE(depth, shape[2]));
+				getImageData(bpIO, bpReader, prefix + variable.first, depth, {0, 0, 0}, {shape[0], shape[1], shape[2]}, image.data);
+			}
+			auto extracted = std::chrono::steady_clock::now();
+			bpReader.Close();
+
+			openMs += std::chrono::duration<double, std::milli>(opened - phaseStart).count();
+			listMs += std::chrono::duration<double, std::milli>(listed - opened).count();
+			extractMs += std::chrono::duration<double, std::milli>(extracted - listed).count();
+		}
+
+		size_t bytes, entries;
+		directoryUsage(benchmarkPath + (packed ? "containers" : "separate"), bytes, entries);
+
+		std::cout << (packed ? "Shared containers" : "File per experiment") << ": "
+		          << "write " << writeSeconds << " s, " << entries << " files and directories, " << bytes / (1024.0 * 1024.0) << " MB | "
+		          << "open " << openMs / samples << " ms, list " << listMs / samples << " ms, extract " << extractMs / samples << " ms" << std::endl;
+	}
+
+	std::cout << "\nLatencies are averaged over " << samples << " random experiments with a warm page cache" << std::endl;
+	fs::remove_all(benchmarkPath);
+}
+
+//*****************************************************************************************************************************************************************
+
+// Manage Image Cache
+
+void manageImageCache() {
+	SharedImageCache& cache = SharedImageCache::instance();
+	std::string choice;
+
+	// A stale or half-initialised segment keeps the cache from attaching, so it can still be removed from here
+	if (!cache.enabled()) {
+		std::cout << "The shared image cache is not attached, set IMAGE_CACHE_MB to its size in MB to enable it." << std::endl;
+		std::cout << "Enter r to remove an existing segment (recreated with IMAGE_CACHE_MB on next use), anything else to keep it: ";
+		std::cin >> choice;
+
+		if (choice == "r") {
+			std::cout << (SharedImageCache::remove() ? "Shared image cache removed" : "No shared image cache segment exists") << std::endl;
+		}
 		return;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	CacheStatistics statistics = cache.statistics();
+	const uint64_t lookups = statistics.hits + statistics.misses;
 
-	// Remove the directory containing the images.bp file
-	std::string outputPath = "/home/pbhatia4/Desktop/Adios2C-Implementation/ImageBPFiles/" + experimentName;
-	fs::remove_all(outputPath);
+	std::cout << "Capacity: " << statistics.capacity / (1024.0 * 1024.0) << " MB" << std::endl;
+	std::cout << "Used: " << statistics.used / (1024.0 * 1024.0) << " MB in " << statistics.entries << " images" << std::endl;
+	std::cout << "Hits: " << statistics.hits << ", Misses: " << statistics.misses << " (" << (lookups ? 100.0 * statistics.hits / lookups : 0.0) << "% hit rate)" << std::endl;
+	std::cout << "Insertions: " << statistics.insertions << ", Evictions: " << statistics.evictions << "\n\n";
 
-	std::cout << "Experiment '" << experimentName << "' Deleted Successfully!" << std::endl;		
-		
+	std::cout << "Enter c to clear the cache, r to remove it (recreated with IMAGE_CACHE_MB on next use), anything else to keep it: ";
+	std::cin >> choice;
+
+	if (choice == "c") {
+		cache.clear();
+		std::cout << "Shared image cache cleared" << std::endl;
+	} else if (choice == "r") {
+		SharedImageCache::remove();
+		std::cout << "Shared image cache removed, processes still attached keep it until they exit" << std::endl;
+	}
 }